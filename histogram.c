@@ -1,123 +1,1042 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "histogram_lib.h"
+#include "histogram_compute.h"
+#include "histogram_jpeg.h"
+#include "histogram_stream.h"
+#include "histogram_delta.h"
+#include "histogram_batch.h"
+#include "histogram_mmap.h"
+#include "histogram_roi.h"
+#include <strings.h>
+#include <signal.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles"
+#else
+#define BENCH_UNIT "ns"
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-void compute_histogram(unsigned char *image_data, int width, int height, int channels, int histogram[256]) {
-    // Initialize histogram to zero
-    memset(histogram, 0, 256 * sizeof(int));
-    
-    // Count pixel intensities
-    int total_pixels = width * height;
-    for (int i = 0; i < total_pixels; i++) {
-        // Calculate grayscale value from RGB
-        int pixel_index = i * channels;
-        int gray_value;
-        
-        if (channels >= 3) {
-            // Convert RGB to grayscale using luminance formula
-            int r = image_data[pixel_index];
-            int g = image_data[pixel_index + 1];
-            int b = image_data[pixel_index + 2];
-            gray_value = (int)(0.299 * r + 0.587 * g + 0.114 * b);
+#define BENCH_REPEAT 5
+
+// Display geometry assumed when no hardware is used
+#define DEFAULT_DISPLAY_WIDTH  32
+#define DEFAULT_DISPLAY_HEIGHT 8
+
+// Default pacing for frame streams
+#define DEFAULT_STREAM_FPS 30
+
+// Hue histogram resolution, one bin per display column
+#define DEFAULT_HUE_BINS 32
+
+// --channel value meaning every channel
+#define CHANNEL_ALL (-1)
+
+// Regions of interest accepted on one command line
+#define MAX_ROIS 16
+
+typedef struct {
+    const char *image_path;
+    histogram_kernel_t kernel;
+    int threads;
+    bool threads_set;           // --threads given, not the default
+    bool bench;
+    bool stream;
+    histogram_jpeg_approx_t approx;
+    const char *frames_path;
+    frame_format_t frames_format;
+    int frames_width;
+    int frames_height;
+    double fps;
+    double delta_threshold;
+    const char *batch_source;
+    const char *batch_out;
+    const char *batch_csv;
+    int channel;
+    int hue_bins;
+    bool display;
+    int rois[MAX_ROIS][4];      // x, y, w, h
+    int roi_count;
+    int roi_bins;
+    histogram_scale_t scale;
+} cli_options_t;
+
+// Running latency of one pipeline stage
+typedef struct {
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t count;
+} stage_stats_t;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// Bar scaling used for everything shown on the display
+static histogram_scale_t display_scale = HISTOGRAM_SCALE_LINEAR;
+
+// Cleared by --no-display: histograms are printed instead of shown
+static bool display_enabled = true;
+
+void print_histogram(const uint32_t histogram[256]) {
+    printf("Histogram (Intensity: Count):\n");
+    for (int i = 0; i < 256; i++) {
+        if (histogram[i] > 0) {
+            printf("%3d: %u\n", i, histogram[i]);
+        }
+    }
+}
+
+static void print_histogram_info(const histogram_hw_config_t *config) {
+    printf("\n=== Hardware Configuration ===\n");
+    printf("Matrices: %d\n", config->matrices);
+    printf("Display size: %d x %d pixels\n", config->width, config->height);
+    printf("=============================\n\n");
+}
+
+static void print_dimensioned_histogram(const uint8_t *hist, int width) {
+    printf("\nDimensioned histogram values:\n");
+    for (int i = 0; i < width; i++) {
+        printf("[%2d]: %d ", i, hist[i]);
+        for (int j = 0; j < hist[i]; j++) {
+            printf("█");
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] <image_file>\n", prog);
+    printf("       (PGM/PPM/raw images are memory-mapped and counted in place)\n");
+    printf("       %s --frames <file|-> [--format gray|rgb|y4m] [--size WxH] [--fps n]\n", prog);
+    printf("       %s --batch <dir|@list> [--out file.hstb] [--csv file.csv]\n", prog);
+    printf("Options:\n");
+    printf("  --kernel <auto|scalar|sse2|avx2>  Pixel kernel used for the histogram\n");
+    printf("  --threads <n>                     Worker threads, 0 = all CPUs (default: $%s or 1;\n"
+           "                                    all CPUs with --batch)\n",
+           HISTOGRAM_THREADS_ENV);
+    printf("  --stream                          Decode JPEG scanline by scanline, counting as it goes\n");
+    printf("  --approx <1|2|4|8>                Approximate JPEG histogram decoded at 1/N scale\n");
+    printf("  --sample <n>                      With --approx, count every Nth pixel and row\n");
+    printf("  --frames <file|->                 Process a stream of raw or Y4M frames (- = stdin)\n");
+    printf("  --format <gray|rgb|y4m>           Frame stream format (default: y4m)\n");
+    printf("  --size <WxH>                      Frame size for raw gray/rgb streams\n");
+    printf("  --fps <n>                         Target display rate, 0 = unpaced (default: %d)\n",
+           DEFAULT_STREAM_FPS);
+    printf("  --delta <fraction>                Update frame histograms incrementally, recount when\n");
+    printf("                                    more than this fraction of pixels changed (e.g. %.2f)\n",
+           HISTOGRAM_DELTA_DEFAULT_THRESHOLD);
+    printf("  --batch <dir|@list>               Count every image of a directory tree or list file\n");
+    printf("  --out <file>                      Batch results in binary HSTB format\n");
+    printf("  --csv <file>                      Batch results as CSV\n");
+    printf("  --channel <luma|red|green|blue|hue|all>\n");
+    printf("                                    Histogram to show; all channels come from one pass\n");
+    printf("  --hue-bins <n>                    Hue histogram bins, power of two (default: %d)\n",
+           DEFAULT_HUE_BINS);
+    printf("  --roi <x,y,w,h>                   Histogram of a region, repeatable; all regions are\n");
+    printf("                                    answered from one integral-histogram index\n");
+    printf("  --roi-bins <n>                    Region histogram bins, power of two (default: %d)\n",
+           HISTOGRAM_INDEX_DEFAULT_BINS);
+    printf("  --scale <linear|sqrt|log>         Bar height scaling (log shows %d decades)\n",
+           HISTOGRAM_LOG_DECADES);
+    printf("  --no-display                      Compute only, don't touch the LED matrix\n");
+    printf("                                    ($%s=%s[:render,sleep,spi=HZ,matrices=N,cols=C,lanes=L]\n"
+           "                                    simulates it)\n",
+           HISTOGRAM_DEVICE_ENV, HISTOGRAM_SIM_PREFIX);
+    printf("  --bench                           Report %s/pixel against the reference loop\n",
+           BENCH_UNIT);
+    printf("                                    (with --approx: latency and error against the exact histogram)\n");
+}
+
+static int parse_kernel(const char *name, histogram_kernel_t *kernel) {
+    if (strcmp(name, "auto") == 0) {
+        *kernel = HISTOGRAM_KERNEL_AUTO;
+    } else if (strcmp(name, "scalar") == 0) {
+        *kernel = HISTOGRAM_KERNEL_SCALAR;
+    } else if (strcmp(name, "sse2") == 0) {
+        *kernel = HISTOGRAM_KERNEL_SSE2;
+    } else if (strcmp(name, "avx2") == 0) {
+        *kernel = HISTOGRAM_KERNEL_AVX2;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_options(int argc, char *argv[], cli_options_t *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->kernel = HISTOGRAM_KERNEL_AUTO;
+    opts->threads = histogram_default_threads();
+    opts->approx.sample_stride = 1;
+    opts->frames_format = FRAME_FORMAT_Y4M;
+    opts->fps = DEFAULT_STREAM_FPS;
+    opts->channel = HISTOGRAM_CHANNEL_LUMA;
+    opts->hue_bins = DEFAULT_HUE_BINS;
+    opts->display = true;
+    opts->roi_bins = HISTOGRAM_INDEX_DEFAULT_BINS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            opts->bench = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            opts->stream = true;
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            if (parse_kernel(argv[++i], &opts->kernel) < 0) {
+                fprintf(stderr, "Unknown kernel: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--approx") == 0 && i + 1 < argc) {
+            char *end;
+            int denom = (int)strtol(argv[++i], &end, 10);
+            // Validated here: 0 would quietly run the exact path
+            if (*end != '\0' || (denom != 1 && denom != 2 && denom != 4 && denom != 8)) {
+                fprintf(stderr, "Invalid approximation scale: %s (expected 1, 2, 4 or 8)\n",
+                        argv[i]);
+                return -1;
+            }
+            opts->approx.scale_denom = denom;
+        } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            opts->approx.sample_stride = atoi(argv[++i]);
+            if (opts->approx.sample_stride < 1) {
+                fprintf(stderr, "Invalid sample stride: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            opts->frames_path = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "gray") == 0) {
+                opts->frames_format = FRAME_FORMAT_GRAY;
+            } else if (strcmp(argv[i], "rgb") == 0) {
+                opts->frames_format = FRAME_FORMAT_RGB;
+            } else if (strcmp(argv[i], "y4m") == 0) {
+                opts->frames_format = FRAME_FORMAT_Y4M;
+            } else {
+                fprintf(stderr, "Unknown frame format: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &opts->frames_width, &opts->frames_height) != 2) {
+                fprintf(stderr, "Invalid frame size: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            opts->fps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--delta") == 0 && i + 1 < argc) {
+            opts->delta_threshold = atof(argv[++i]);
+            if (opts->delta_threshold <= 0.0 || opts->delta_threshold > 1.0) {
+                fprintf(stderr, "Invalid delta threshold: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            opts->batch_source = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            opts->batch_out = argv[++i];
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            opts->batch_csv = argv[++i];
+        } else if (strcmp(argv[i], "--channel") == 0 && i + 1 < argc) {
+            static const char *const channels[] = { "red", "green", "blue", "luma", "hue" };
+            i++;
+            opts->channel = -2;
+            for (int c = 0; c < 5; c++) {
+                if (strcmp(argv[i], channels[c]) == 0)
+                    opts->channel = c;
+            }
+            if (strcmp(argv[i], "all") == 0)
+                opts->channel = CHANNEL_ALL;
+            if (opts->channel == -2) {
+                fprintf(stderr, "Unknown channel: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--hue-bins") == 0 && i + 1 < argc) {
+            opts->hue_bins = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--roi") == 0 && i + 1 < argc) {
+            int *roi = opts->rois[opts->roi_count];
+            if (opts->roi_count == MAX_ROIS) {
+                fprintf(stderr, "Too many regions (max %d)\n", MAX_ROIS);
+                return -1;
+            }
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &roi[0], &roi[1], &roi[2], &roi[3]) != 4) {
+                fprintf(stderr, "Invalid region: %s (expected x,y,w,h)\n", argv[i]);
+                return -1;
+            }
+            opts->roi_count++;
+        } else if (strcmp(argv[i], "--roi-bins") == 0 && i + 1 < argc) {
+            opts->roi_bins = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "linear") == 0) {
+                opts->scale = HISTOGRAM_SCALE_LINEAR;
+            } else if (strcmp(argv[i], "sqrt") == 0) {
+                opts->scale = HISTOGRAM_SCALE_SQRT;
+            } else if (strcmp(argv[i], "log") == 0) {
+                opts->scale = HISTOGRAM_SCALE_LOG;
+            } else {
+                fprintf(stderr, "Unknown scale: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--no-display") == 0) {
+            opts->display = false;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            char *end;
+            long threads = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || threads < 0 || threads > HISTOGRAM_MAX_THREADS) {
+                fprintf(stderr, "Invalid thread count: %s (0-%d, 0 = all CPUs)\n", argv[i],
+                        HISTOGRAM_MAX_THREADS);
+                return -1;
+            }
+            opts->threads = (int)threads;
+            opts->threads_set = true;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return -1;
         } else {
-            // Grayscale image
-            gray_value = image_data[pixel_index];
+            opts->image_path = argv[i];
         }
-        
-        histogram[gray_value]++;
     }
+
+    return opts->image_path != NULL || opts->frames_path != NULL ||
+           opts->batch_source != NULL ? 0 : -1;
 }
 
-void print_histogram(int histogram[256]) {
-    printf("Histogram (Intensity: Count):\n");
+// Cycle counter on x86, monotonic nanoseconds elsewhere
+static uint64_t bench_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+typedef void (*histogram_fn)(const unsigned char *, int, int, int, uint32_t[256],
+                             histogram_kernel_t);
+
+static int bench_threads = 1;
+
+static void reference_fn(const unsigned char *data, int width, int height, int channels,
+                         uint32_t histogram[256], histogram_kernel_t kernel) {
+    (void)kernel;
+    compute_histogram_reference(data, width, height, channels, histogram);
+}
+
+static void parallel_fn(const unsigned char *data, int width, int height, int channels,
+                        uint32_t histogram[256], histogram_kernel_t kernel) {
+    compute_histogram_parallel(data, width, height, channels, histogram, kernel, bench_threads);
+}
+
+// Best of BENCH_REPEAT runs, in BENCH_UNIT per pixel
+static double bench_run(histogram_fn fn, histogram_kernel_t kernel,
+                        const unsigned char *data, int width, int height, int channels,
+                        uint32_t histogram[256]) {
+    uint64_t best = UINT64_MAX;
+
+    for (int rep = 0; rep < BENCH_REPEAT; rep++) {
+        uint64_t start = bench_now();
+        fn(data, width, height, channels, histogram, kernel);
+        uint64_t elapsed = bench_now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return (double)best / ((double)width * height);
+}
+
+// Pixels that land in a different bin than in the reference histogram
+static uint64_t bench_moved(const uint32_t histogram[256], const uint32_t reference[256]) {
+    uint64_t moved = 0;
+
     for (int i = 0; i < 256; i++) {
-        if (histogram[i] > 0) {
-            printf("%3d: %d\n", i, histogram[i]);
-        }
+        moved += histogram[i] > reference[i] ? histogram[i] - reference[i] : 0;
     }
+    return moved;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: %s <image_file>\n", argv[0]);
-        return 1;
+static void run_bench(const unsigned char *data, int width, int height, int channels,
+                      histogram_kernel_t kernel, int threads) {
+    static const histogram_kernel_t kernels[] = {
+        HISTOGRAM_KERNEL_SCALAR, HISTOGRAM_KERNEL_SSE2, HISTOGRAM_KERNEL_AVX2
+    };
+    uint32_t reference[256];
+    uint32_t histogram[256];
+
+    double base = bench_run(reference_fn, HISTOGRAM_KERNEL_AUTO,
+                            data, width, height, channels, reference);
+
+    printf("%-10s %10s/px %8s %12s\n", "kernel", BENCH_UNIT, "speedup", "moved px");
+    printf("%-10s %13.3f %7.2fx %12s\n", "reference", base, 1.0, "-");
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (histogram_kernel_resolve(kernels[k]) != kernels[k])
+            continue;
+
+        double cost = bench_run(compute_histogram_kernel, kernels[k],
+                                data, width, height, channels, histogram);
+
+        printf("%-10s %13.3f %7.2fx %12llu\n", histogram_kernel_name(kernels[k]),
+               cost, base / cost, (unsigned long long)bench_moved(histogram, reference));
     }
 
+    if (threads != 1) {
+        uint32_t serial[256];
+        char label[32];
 
+        // Parallel result must match the serial kernel exactly
+        compute_histogram_kernel(data, width, height, channels, serial, kernel);
+        bench_threads = threads;
+        double cost = bench_run(parallel_fn, kernel, data, width, height, channels, histogram);
+
+        snprintf(label, sizeof(label), "%s x%d", histogram_kernel_name(histogram_kernel_resolve(kernel)),
+                 threads);
+        printf("%-10s %13.3f %7.2fx %12llu%s\n", label, cost, base / cost,
+               (unsigned long long)bench_moved(histogram, reference),
+               memcmp(histogram, serial, sizeof(serial)) == 0 ? "" : "  MISMATCH");
+    }
+}
+
+// Show one or more 256-bin histograms on the LED matrix, a few seconds each
+static int show_histograms(const uint32_t (*histograms)[256], const char *const *labels,
+                           int count) {
     histogram_hw_config_t config;
-    uint32_t histogram[256];
+    histogram_plan_t *plan;
     uint8_t *dimensioned;
-    int result;
-    
+    int result = 0;
+
+    if (!display_enabled) {
+        for (int i = 0; i < count; i++) {
+            printf("%s ", labels[i]);
+            print_histogram(histograms[i]);
+        }
+        return 0;
+    }
+
     printf("=== MAX7219 Histogram Library Test ===\n\n");
-    
+
     // Initialize library
     printf("Initializing histogram display...\n");
-    result = histogram_init();
-    if (result < 0) {
+    if (histogram_init() < 0) {
         fprintf(stderr, "Failed to initialize histogram display\n");
-        return 1;
+        return -1;
     }
     printf("✓ Initialization successful\n");
-    
+
     // Get hardware configuration
-    result = histogram_get_hw_config(&config);
-    if (result < 0) {
+    if (histogram_get_hw_config(&config) < 0) {
         fprintf(stderr, "Failed to get hardware configuration\n");
         histogram_cleanup();
-        return 1;
+        return -1;
     }
     print_histogram_info(&config);
-    
+
     // Allocate dimensioned histogram
     dimensioned = malloc(config.width * sizeof(uint8_t));
     if (dimensioned == NULL) {
         fprintf(stderr, "Failed to allocate memory\n");
         histogram_cleanup();
-        return 1;
+        return -1;
+    }
+
+    plan = histogram_plan_create(256, config.width, config.height, display_scale);
+    if (plan == NULL) {
+        free(dimensioned);
+        histogram_cleanup();
+        return -1;
     }
 
     histogram_clear();
     sleep(1);
-    
+
+    for (int i = 0; i < count; i++) {
+        histogram_plan_apply(plan, histograms[i], dimensioned);
+        print_dimensioned_histogram(dimensioned, config.width);
+        if (histogram_display(dimensioned, config.width) < 0) {
+            fprintf(stderr, "Failed to display histogram\n");
+            result = -1;
+        } else {
+            printf("✓ %s histogram displayed\n", labels[i]);
+        }
+        sleep(4);
+    }
+
+    // Clean up
+    histogram_plan_destroy(plan);
+    free(dimensioned);
+    histogram_cleanup();
+
+    return result;
+}
+
+static int show_histogram(const uint32_t histogram[256]) {
+    static const char *const label = "Image";
+    return show_histograms((const uint32_t (*)[256])histogram, &label, 1);
+}
+
+// Compute every channel in one pass, then show the requested ones
+static int show_channels(const unsigned char *image_data, int width, int height, int channels,
+                         const cli_options_t *opts) {
+    static const char *const names[] = { "Red", "Green", "Blue", "Luma", "Hue" };
+    histogram_multi_t *multi;
+    uint32_t histograms[5][256];
+    const char *labels[5];
+    int count = 0;
+
+    multi = malloc(sizeof(*multi));
+    if (multi == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return -1;
+    }
+    bool want_hue = opts->channel == CHANNEL_ALL || opts->channel == HISTOGRAM_CHANNEL_HUE;
+    if (compute_histogram_multi(image_data, width, height, channels,
+                                want_hue ? opts->hue_bins : 0, multi) < 0) {
+        fprintf(stderr, "Invalid hue bins: %d\n", opts->hue_bins);
+        free(multi);
+        return -1;
+    }
+
+    // Picking a histogram is just a copy out of the interleaved set
+    for (int c = HISTOGRAM_CHANNEL_RED; c <= HISTOGRAM_CHANNEL_HUE; c++) {
+        if (opts->channel >= 0 && opts->channel != c)
+            continue;
+        if (histogram_multi_extract(multi, (histogram_channel_t)c, histograms[count]) == 0)
+            labels[count++] = names[c];
+    }
+    free(multi);
+
+    return show_histograms((const uint32_t (*)[256])histograms, labels, count);
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Decode and count a JPEG scanline by scanline, without a full image buffer
+static int stream_jpeg_histogram(const char *path, uint32_t histogram[256], double *ms) {
+    struct timespec start, end;
     int width, height, channels;
-    unsigned char *image_data = stbi_load(argv[1], &width, &height, &channels, 0);
-    
-    if (image_data == NULL) {
-        printf("Error: Could not load image '%s'\n", argv[1]);
-        return 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (histogram_jpeg_stream(path, histogram, &width, &height, &channels) < 0) {
+        printf("Error: Could not stream JPEG '%s'\n", path);
+        return -1;
     }
-    
-    printf("Image loaded: %dx%d, %d channels\n", width, height, channels);
-    
-    // Create histogram array
-    int histogram[256];
-    
-    // Compute histogram
-    compute_histogram(image_data, width, height, channels, histogram);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
+    printf("Image streamed: %dx%d, %d channels, %.1f ms, row buffer %d bytes\n",
+           width, height, channels, elapsed_ms(&start, &end), width * channels);
+    if (ms != NULL)
+        *ms = elapsed_ms(&start, &end);
+    return 0;
+}
 
+// Reduced-size decode with optional sampling; with bench, also measure
+// latency and error against the exact streamed histogram
+static int approx_jpeg_histogram(const char *path, const histogram_jpeg_approx_t *approx,
+                                 bool bench, uint32_t histogram[256]) {
+    struct timespec start, end;
+    histogram_jpeg_info_t info;
 
-    result = histogram_dimension(histogram, dimensioned, config.width, config.height);
-    if (result < 0) {
-        fprintf(stderr, "Failed to dimension histogram\n");
-    } else {
-        print_dimensioned_histogram(dimensioned, config.width);
-        result = histogram_display(dimensioned, config.width);
-        if (result < 0) {
-            fprintf(stderr, "Failed to display histogram\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (histogram_jpeg_approx(path, approx, histogram, &info) < 0) {
+        printf("Error: Could not decode JPEG '%s'\n", path);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double approx_ms = elapsed_ms(&start, &end);
+    printf("Approximate histogram: %dx%d decoded at 1/%d (%dx%d), stride %d, %llu samples, %.2f ms\n",
+           info.width, info.height, approx->scale_denom, info.out_width, info.out_height,
+           approx->sample_stride, (unsigned long long)info.samples, approx_ms);
+    if (approx->sample_stride > 1) {
+        printf("Sampling error: each bar within ±%.2f%% of all pixels (95%% confidence)\n",
+               100.0 * histogram_sampling_bound(info.samples, 0.95));
+    }
+
+    if (!bench)
+        return 0;
+
+    uint32_t exact[256];
+    uint8_t exact_bars[DEFAULT_DISPLAY_WIDTH];
+    uint8_t approx_bars[DEFAULT_DISPLAY_WIDTH];
+    double exact_ms;
+    int max_bar_error = 0;
+
+    if (stream_jpeg_histogram(path, exact, &exact_ms) < 0)
+        return -1;
+
+    histogram_dimension(exact, exact_bars, DEFAULT_DISPLAY_WIDTH, DEFAULT_DISPLAY_HEIGHT);
+    histogram_dimension(histogram, approx_bars, DEFAULT_DISPLAY_WIDTH, DEFAULT_DISPLAY_HEIGHT);
+    for (int i = 0; i < DEFAULT_DISPLAY_WIDTH; i++) {
+        int diff = abs((int)exact_bars[i] - (int)approx_bars[i]);
+        if (diff > max_bar_error)
+            max_bar_error = diff;
+    }
+
+    printf("Speedup vs exact: %.1fx\n", exact_ms / approx_ms);
+    printf("Error vs exact: %.3f%% of pixels in another bin, max bar error %d/%d LEDs (%dx%d)\n",
+           100.0 * histogram_distance(exact, histogram), max_bar_error,
+           DEFAULT_DISPLAY_HEIGHT, DEFAULT_DISPLAY_WIDTH, DEFAULT_DISPLAY_HEIGHT);
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void stage_add(stage_stats_t *stage, uint64_t ns) {
+    stage->total_ns += ns;
+    stage->count++;
+    if (ns > stage->max_ns)
+        stage->max_ns = ns;
+}
+
+static void stage_print(const char *name, const stage_stats_t *stage) {
+    if (stage->count == 0) {
+        printf("  %-10s -\n", name);
+        return;
+    }
+    printf("  %-10s avg %8.3f ms  max %8.3f ms\n", name,
+           stage->total_ns / 1e6 / stage->count, stage->max_ns / 1e6);
+}
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/*
+ * Read frames continuously and push each one's histogram to the display
+ * at the target rate. Frames that arrive more than one period late are
+ * counted as dropped and skipped, so a slow display never builds a
+ * backlog. All buffers are allocated once up front.
+ */
+static int run_frame_stream(const cli_options_t *opts) {
+    histogram_hw_config_t config = { 0, DEFAULT_DISPLAY_WIDTH, DEFAULT_DISPLAY_HEIGHT };
+    stage_stats_t read_stage = { 0 }, count_stage = { 0 }, dim_stage = { 0 }, display_stage = { 0 };
+    uint64_t frames = 0, shown = 0, dropped = 0, report_shown = 0;
+    uint64_t period_ns = opts->fps > 0 ? (uint64_t)(1e9 / opts->fps) : 0;
+    uint64_t start, next_due, report_at, t0, t1;
+    uint32_t histogram[256];
+    histogram_plan_t *plan;
+    uint8_t *dimensioned;
+    const uint8_t *pixels;
+    frame_stream_t *stream;
+    histogram_delta_t *delta = NULL;
+    int rc = 0, result = 0;
+
+    stream = frame_stream_open(opts->frames_path, opts->frames_format,
+                               opts->frames_width, opts->frames_height);
+    if (stream == NULL)
+        return -1;
+
+    if (opts->delta_threshold > 0.0) {
+        delta = histogram_delta_create(frame_stream_width(stream), frame_stream_height(stream),
+                                       frame_stream_channels(stream), opts->delta_threshold);
+        if (delta == NULL) {
+            frame_stream_close(stream);
+            return -1;
+        }
+    }
+
+    if (opts->display) {
+        if (histogram_init() < 0 || histogram_get_hw_config(&config) < 0) {
+            fprintf(stderr, "Failed to initialize histogram display\n");
+            histogram_cleanup();
+            histogram_delta_destroy(delta);
+            frame_stream_close(stream);
+            return -1;
+        }
+    }
+
+    dimensioned = malloc(config.width * sizeof(uint8_t));
+    if (dimensioned == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        if (opts->display)
+            histogram_cleanup();
+        histogram_delta_destroy(delta);
+        frame_stream_close(stream);
+        return -1;
+    }
+
+    plan = histogram_plan_create(256, config.width, config.height, display_scale);
+    if (plan == NULL) {
+        free(dimensioned);
+        if (opts->display)
+            histogram_cleanup();
+        histogram_delta_destroy(delta);
+        frame_stream_close(stream);
+        return -1;
+    }
+
+    printf("Streaming %dx%d frames (%d channels), target %.1f fps\n",
+           frame_stream_width(stream), frame_stream_height(stream),
+           frame_stream_channels(stream), opts->fps);
+
+    signal(SIGINT, handle_stop);
+    start = next_due = t0 = now_ns();
+    report_at = start + 1000000000ull;
+
+    while (!stop_requested && (rc = frame_stream_read(stream, &pixels)) == 1) {
+        t1 = now_ns();
+        stage_add(&read_stage, t1 - t0);
+        frames++;
+
+        if (period_ns > 0 && t1 > next_due + period_ns) {
+            // Too late to be worth showing; catch up on the next frame
+            dropped++;
+            next_due += period_ns;
+            t0 = now_ns();
+            continue;
+        }
+
+        if (delta != NULL) {
+            histogram_delta_update(delta, pixels, histogram);
         } else {
-            printf("✓ Gaussian histogram displayed\n");
+            compute_histogram_parallel(pixels, frame_stream_width(stream),
+                                       frame_stream_height(stream), frame_stream_channels(stream),
+                                       histogram, opts->kernel, opts->threads);
+        }
+        t0 = now_ns();
+        stage_add(&count_stage, t0 - t1);
+
+        histogram_plan_apply(plan, histogram, dimensioned);
+        t1 = now_ns();
+        stage_add(&dim_stage, t1 - t0);
+
+        if (opts->display) {
+            // Hand the frame to the display thread; the SPI flush overlaps the next count
+            if (histogram_display_async(dimensioned, config.width) < 0)
+                result = -1;
+            t0 = now_ns();
+            stage_add(&display_stage, t0 - t1);
+        }
+        shown++;
+
+        if (period_ns > 0) {
+            next_due += period_ns;
+            if (next_due > now_ns()) {
+                struct timespec due = {
+                    (time_t)(next_due / 1000000000ull), (long)(next_due % 1000000000ull)
+                };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+            }
+        }
+
+        t0 = now_ns();
+        if (t0 >= report_at) {
+            printf("frame %llu: %.1f fps, %llu dropped\n", (unsigned long long)frames,
+                   (shown - report_shown) * 1e9 / (t0 - report_at + 1000000000ull),
+                   (unsigned long long)dropped);
+            report_shown = shown;
+            report_at = t0 + 1000000000ull;
         }
     }
-    sleep(4);
+    if (!stop_requested && rc < 0)
+        result = -1;
 
-    // Clean up
-    stbi_image_free(image_data);
-    
+    double seconds = (now_ns() - start) / 1e9;
+    printf("\n=== Frame stream summary ===\n");
+    printf("Frames read: %llu, shown: %llu, dropped: %llu\n", (unsigned long long)frames,
+           (unsigned long long)shown, (unsigned long long)dropped);
+    printf("Sustained rate: %.2f fps over %.2f s\n", seconds > 0 ? shown / seconds : 0.0, seconds);
+    printf("Per-stage latency:\n");
+    stage_print("read", &read_stage);
+    stage_print("histogram", &count_stage);
+    stage_print("dimension", &dim_stage);
+    stage_print("submit", &display_stage);
+
+    if (opts->display) {
+        histogram_async_stats_t async;
+        if (histogram_display_flush() < 0)
+            result = -1;
+        histogram_get_async_stats(&async);
+        printf("Display thread: %llu of %llu frames flushed, %llu superseded, %.2f ms/flush\n",
+               (unsigned long long)async.displayed, (unsigned long long)async.submitted,
+               (unsigned long long)async.dropped, async.flush_ns / 1e6);
+
+        histogram_stats_t lib_stats;
+        histogram_get_stats(&lib_stats);
+        printf("Display library:\n");
+        histogram_print_stats(stdout, &lib_stats);
+    }
+
+    if (delta != NULL) {
+        histogram_delta_stats_t stats;
+        histogram_delta_get_stats(delta, &stats);
+        // Recounted frames aren't diffed, so their changed pixels are unknown
+        printf("Delta updates: %llu of %llu frames recounted (%.1f%%), "
+               "%.2f%% of pixels updated incrementally\n",
+               (unsigned long long)stats.recounts, (unsigned long long)stats.frames,
+               stats.frames ? 100.0 * stats.recounts / stats.frames : 0.0,
+               stats.total_pixels ? 100.0 * stats.changed_pixels / stats.total_pixels : 0.0);
+    }
+
+    histogram_plan_destroy(plan);
+    free(dimensioned);
+    histogram_delta_destroy(delta);
+    if (opts->display)
+        histogram_cleanup();
+    frame_stream_close(stream);
+    return result;
+}
+
+// Decoded or memory-mapped input image
+typedef struct {
+    const unsigned char *pixels;
+    int width;
+    int height;
+    int channels;
+    unsigned char *decoded;     // stb_image buffer, NULL when mapped
+    mapped_image_t mapped;
+} input_image_t;
+
+// PGM/PPM/raw files are mapped in place, everything else goes through stb_image
+static int load_image(const char *path, input_image_t *image) {
+    memset(image, 0, sizeof(*image));
+
+    if (mapped_image_supported(path)) {
+        if (mapped_image_open(path, &image->mapped) < 0)
+            return -1;
+        image->pixels = image->mapped.pixels;
+        image->width = image->mapped.width;
+        image->height = image->mapped.height;
+        image->channels = image->mapped.channels;
+        return 0;
+    }
+
+    image->decoded = stbi_load(path, &image->width, &image->height, &image->channels, 0);
+    if (image->decoded == NULL) {
+        fprintf(stderr, "Could not load image '%s'\n", path);
+        return -1;
+    }
+    image->pixels = image->decoded;
     return 0;
-}
\ No newline at end of file
+}
+
+static void free_image(input_image_t *image) {
+    if (image->decoded != NULL)
+        stbi_image_free(image->decoded);
+    mapped_image_close(&image->mapped);
+    memset(image, 0, sizeof(*image));
+}
+
+// Batch worker callback: JPEGs are streamed, everything else goes through load_image()
+static int count_image_file(const char *path, uint32_t histogram[256], void *user) {
+    const char *dot = strrchr(path, '.');
+    input_image_t image;
+
+    (void)user;
+    if (dot != NULL && (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0))
+        return histogram_jpeg_stream(path, histogram, NULL, NULL, NULL);
+
+    if (load_image(path, &image) < 0)
+        return -1;
+    compute_histogram(image.pixels, image.width, image.height, image.channels, histogram);
+    free_image(&image);
+    return 0;
+}
+
+// Count a whole directory or file list on a worker pool
+static int run_batch(const cli_options_t *opts) {
+    histogram_batch_t batch;
+    uint64_t total[256] = { 0 };
+    uint64_t max_bin = 0;
+    uint32_t histogram[256];
+    int result = 0, shift = 0;
+
+    if (histogram_batch_collect(opts->batch_source, &batch) < 0)
+        return -1;
+
+    // Images are independent, so batches use every CPU unless told otherwise
+    printf("Batch: %zu images, %.1f MB\n", batch.count, batch.total_bytes / 1e6);
+    histogram_batch_run(&batch, opts->threads_set ? opts->threads : 0, count_image_file, NULL);
+
+    printf("Counted %zu images (%zu failed) in %.2f s: %.1f images/s, %.1f MB/s\n",
+           batch.count - batch.failed, batch.failed, batch.seconds,
+           batch.seconds > 0 ? batch.count / batch.seconds : 0.0,
+           batch.seconds > 0 ? batch.total_bytes / 1e6 / batch.seconds : 0.0);
+
+    if (opts->batch_out != NULL &&
+        histogram_batch_write_binary(&batch, opts->batch_out) < 0)
+        result = -1;
+    if (opts->batch_csv != NULL && histogram_batch_write_csv(&batch, opts->batch_csv) < 0)
+        result = -1;
+
+    if (opts->display && batch.count > batch.failed) {
+        // Show the combined histogram, scaled down if it overflows 32 bits
+        for (size_t i = 0; i < batch.count; i++) {
+            for (int bin = 0; bin < 256; bin++)
+                total[bin] += batch.histograms[i][bin];
+        }
+        for (int bin = 0; bin < 256; bin++) {
+            if (total[bin] > max_bin)
+                max_bin = total[bin];
+        }
+        while ((max_bin >> shift) > UINT32_MAX)
+            shift++;
+        for (int bin = 0; bin < 256; bin++)
+            histogram[bin] = (uint32_t)(total[bin] >> shift);
+
+        if (show_histogram(histogram) < 0)
+            result = -1;
+    }
+
+    histogram_batch_free(&batch);
+    return result;
+}
+
+// Answer every --roi from one index built on the loaded image
+static int run_rois(const input_image_t *image, const cli_options_t *opts) {
+    uint32_t histograms[MAX_ROIS][256];
+    uint32_t coarse[256], exact[256];
+    char names[MAX_ROIS][48];
+    const char *labels[MAX_ROIS];
+    struct timespec start, end;
+    histogram_index_t *index;
+    int count = 0, result = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    index = histogram_index_create(image->pixels, image->width, image->height, image->channels,
+                                   HISTOGRAM_INDEX_DEFAULT_TILE, opts->roi_bins);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (index == NULL)
+        return -1;
+
+    int bins = histogram_index_bins(index);
+    printf("Index: %d bins, %dx%d tiles, built in %.2f ms\n", bins,
+           HISTOGRAM_INDEX_DEFAULT_TILE, HISTOGRAM_INDEX_DEFAULT_TILE, elapsed_ms(&start, &end));
+
+    for (int r = 0; r < opts->roi_count; r++) {
+        const int *roi = opts->rois[r];
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int64_t pixels = histogram_index_query(index, roi[0], roi[1], roi[2], roi[3], coarse);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (pixels < 0) {
+            fprintf(stderr, "Region %d,%d,%d,%d is outside the %dx%d image\n",
+                    roi[0], roi[1], roi[2], roi[3], image->width, image->height);
+            result = -1;
+            continue;
+        }
+        printf("ROI %d,%d %dx%d: %lld px, query %.3f ms", roi[0], roi[1], roi[2], roi[3],
+               (long long)pixels, elapsed_ms(&start, &end));
+
+        if (opts->bench) {
+            // Rescan the region row by row for comparison
+            size_t row_bytes = (size_t)image->width * image->channels;
+            uint64_t moved = 0;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            memset(exact, 0, sizeof(exact));
+            for (int y = roi[1]; y < roi[1] + roi[3]; y++)
+                histogram_accumulate(image->pixels + y * row_bytes + (size_t)roi[0] * image->channels,
+                                     (size_t)roi[2], image->channels, exact);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            for (int b = 0; b < bins; b++) {
+                uint32_t sum = 0;
+                for (int k = 0; k < 256 / bins; k++)
+                    sum += exact[b * (256 / bins) + k];
+                moved += sum > coarse[b] ? sum - coarse[b] : 0;
+            }
+            printf(", rescan %.3f ms, mismatched px %llu", elapsed_ms(&start, &end),
+                   (unsigned long long)moved);
+        }
+        printf("\n");
+
+        histogram_index_expand(index, coarse, histograms[count]);
+        snprintf(names[count], sizeof(names[count]), "ROI %d,%d %dx%d",
+                 roi[0], roi[1], roi[2], roi[3]);
+        labels[count] = names[count];
+        count++;
+    }
+    histogram_index_destroy(index);
+
+    if (opts->display && !opts->bench && count > 0 &&
+        show_histograms((const uint32_t (*)[256])histograms, labels, count) < 0)
+        result = -1;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    cli_options_t opts;
+    uint32_t histogram[256];
+
+    if (parse_options(argc, argv, &opts) < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    display_scale = opts.scale;
+    display_enabled = opts.display;
+
+    if (opts.frames_path != NULL)
+        return run_frame_stream(&opts) < 0 ? 1 : 0;
+
+    if (opts.batch_source != NULL)
+        return run_batch(&opts) < 0 ? 1 : 0;
+
+    if (opts.approx.scale_denom > 0) {
+        if (approx_jpeg_histogram(opts.image_path, &opts.approx, opts.bench, histogram) < 0)
+            return 1;
+        if (opts.bench)
+            return 0;
+        return show_histogram(histogram) < 0 ? 1 : 0;
+    }
+
+    if (opts.stream && !opts.bench) {
+        if (stream_jpeg_histogram(opts.image_path, histogram, NULL) < 0)
+            return 1;
+        return show_histogram(histogram) < 0 ? 1 : 0;
+    }
+
+    input_image_t image;
+    struct timespec load_start, load_end;
+
+    clock_gettime(CLOCK_MONOTONIC, &load_start);
+    if (load_image(opts.image_path, &image) < 0)
+        return 1;
+    clock_gettime(CLOCK_MONOTONIC, &load_end);
+
+    printf("Image loaded: %dx%d, %d channels%s\n", image.width, image.height, image.channels,
+           image.decoded == NULL ? " (mapped)" : "");
+
+    if (opts.roi_count > 0) {
+        int result = run_rois(&image, &opts);
+        free_image(&image);
+        return result < 0 ? 1 : 0;
+    }
+
+    if (opts.bench) {
+        printf("Load: %.2f ms\n", elapsed_ms(&load_start, &load_end));
+        run_bench(image.pixels, image.width, image.height, image.channels,
+                  opts.kernel, opts.threads);
+        free_image(&image);
+        if (opts.stream)
+            stream_jpeg_histogram(opts.image_path, histogram, NULL);
+        return 0;
+    }
+
+    if (opts.channel != HISTOGRAM_CHANNEL_LUMA) {
+        int result = show_channels(image.pixels, image.width, image.height, image.channels,
+                                   &opts);
+        free_image(&image);
+        return result < 0 ? 1 : 0;
+    }
+
+    // Compute histogram straight from the decoded buffer or the mapped pages
+    compute_histogram_parallel(image.pixels, image.width, image.height, image.channels,
+                               histogram, opts.kernel, opts.threads);
+    free_image(&image);
+
+    return show_histogram(histogram) < 0 ? 1 : 0;
+}
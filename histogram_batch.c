@@ -0,0 +1,373 @@
+#define _POSIX_C_SOURCE 200809L
+#include "histogram_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const char *const image_extensions[] = {
+    ".jpg", ".jpeg", ".png", ".bmp", ".pgm", ".ppm", ".pnm", ".tga", ".gif", NULL
+};
+
+// Shared state of one batch run
+typedef struct {
+    histogram_batch_t *batch;
+    histogram_batch_fn fn;
+    void *user;
+    atomic_size_t next;
+    atomic_size_t failed;
+} batch_job_t;
+
+static int has_image_extension(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    int i;
+
+    if (dot == NULL)
+        return 0;
+    for (i = 0; image_extensions[i] != NULL; i++) {
+        if (strcasecmp(dot, image_extensions[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Growable list of files found while collecting
+typedef struct {
+    char *path;
+    uint64_t size;
+} batch_entry_t;
+
+typedef struct {
+    batch_entry_t *entries;
+    size_t count;
+    size_t capacity;
+} batch_list_t;
+
+static int list_add(batch_list_t *list, const char *path, uint64_t size)
+{
+    if (list->count == list->capacity) {
+        size_t grown = list->capacity ? list->capacity * 2 : 256;
+        batch_entry_t *entries = realloc(list->entries, grown * sizeof(*entries));
+        if (entries == NULL)
+            return -1;
+        list->entries = entries;
+        list->capacity = grown;
+    }
+
+    list->entries[list->count].path = strdup(path);
+    if (list->entries[list->count].path == NULL)
+        return -1;
+    list->entries[list->count].size = size;
+    list->count++;
+    return 0;
+}
+
+static int walk_directory(batch_list_t *list, const char *dir_path)
+{
+    struct dirent *entry;
+    struct stat st;
+    char path[4096];
+    DIR *dir;
+    int result = 0;
+
+    dir = opendir(dir_path);
+    if (dir == NULL) {
+        perror(dir_path);
+        return -1;
+    }
+
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (stat(path, &st) < 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            result = walk_directory(list, path);
+        else if (S_ISREG(st.st_mode) && has_image_extension(entry->d_name))
+            result = list_add(list, path, (uint64_t)st.st_size);
+    }
+
+    closedir(dir);
+    return result;
+}
+
+static int read_list(batch_list_t *list, const char *list_path)
+{
+    char line[4096];
+    struct stat st;
+    FILE *file;
+    int result = 0;
+
+    file = fopen(list_path, "r");
+    if (file == NULL) {
+        perror(list_path);
+        return -1;
+    }
+
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        result = list_add(list, line, stat(line, &st) == 0 ? (uint64_t)st.st_size : 0);
+    }
+
+    fclose(file);
+    return result;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const batch_entry_t *)a)->path, ((const batch_entry_t *)b)->path);
+}
+
+int histogram_batch_collect(const char *source, histogram_batch_t *batch)
+{
+    batch_list_t list = { NULL, 0, 0 };
+    size_t slots, i;
+    int result;
+
+    if (source == NULL || batch == NULL) {
+        fprintf(stderr, "Invalid batch arguments\n");
+        return -1;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+
+    if (source[0] == '@') {
+        // List files keep the caller's order
+        result = read_list(&list, source + 1);
+    } else {
+        // Directory walks are sorted so output order is reproducible
+        result = walk_directory(&list, source);
+        if (result == 0 && list.count > 1)
+            qsort(list.entries, list.count, sizeof(*list.entries), compare_entries);
+    }
+
+    slots = list.count ? list.count : 1;
+    batch->paths = calloc(slots, sizeof(*batch->paths));
+    batch->sizes = calloc(slots, sizeof(*batch->sizes));
+    batch->histograms = calloc(slots, sizeof(*batch->histograms));
+    batch->status = calloc(slots, sizeof(*batch->status));
+    if (result == 0 && (batch->paths == NULL || batch->sizes == NULL ||
+                        batch->histograms == NULL || batch->status == NULL)) {
+        perror("Failed to allocate batch");
+        result = -1;
+    }
+
+    for (i = 0; i < list.count; i++) {
+        if (result == 0) {
+            batch->paths[i] = list.entries[i].path;
+            batch->sizes[i] = list.entries[i].size;
+            batch->total_bytes += list.entries[i].size;
+            batch->count++;
+        } else {
+            free(list.entries[i].path);
+        }
+    }
+    free(list.entries);
+
+    if (result < 0) {
+        fprintf(stderr, "Failed to collect batch from %s\n", source);
+        histogram_batch_free(batch);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *batch_worker(void *arg)
+{
+    batch_job_t *job = (batch_job_t *)arg;
+    histogram_batch_t *batch = job->batch;
+    size_t i;
+
+    while ((i = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed)) < batch->count) {
+        if (job->fn(batch->paths[i], batch->histograms[i], job->user) < 0) {
+            memset(batch->histograms[i], 0, sizeof(batch->histograms[i]));
+            batch->status[i] = -1;
+            atomic_fetch_add_explicit(&job->failed, 1, memory_order_relaxed);
+        } else {
+            batch->status[i] = 0;
+        }
+    }
+
+    return NULL;
+}
+
+int histogram_batch_run(histogram_batch_t *batch, int threads,
+                        histogram_batch_fn fn, void *user)
+{
+    struct timespec start, end;
+    pthread_t *workers;
+    batch_job_t job;
+    int t, started;
+
+    if (batch == NULL || fn == NULL) {
+        fprintf(stderr, "Invalid batch arguments\n");
+        return -1;
+    }
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if ((size_t)threads > batch->count)
+        threads = batch->count > 0 ? (int)batch->count : 1;
+
+    job.batch = batch;
+    job.fn = fn;
+    job.user = user;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, 0);
+
+    workers = malloc(threads * sizeof(*workers));
+    if (workers == NULL) {
+        perror("Failed to allocate worker pool");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The calling thread is worker 0
+    for (started = 0, t = 1; t < threads; t++) {
+        if (pthread_create(&workers[started], NULL, batch_worker, &job) == 0)
+            started++;
+    }
+    batch_worker(&job);
+    for (t = 0; t < started; t++)
+        pthread_join(workers[t], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(workers);
+
+    batch->failed = atomic_load(&job.failed);
+    batch->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return batch->failed == 0 ? 0 : -1;
+}
+
+static void put_le(uint8_t *out, uint64_t value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        out[i] = (uint8_t)(value >> (8 * i));
+}
+
+int histogram_batch_write_binary(const histogram_batch_t *batch, const char *path)
+{
+    uint8_t header[16];
+    uint8_t record[256 * 4];
+    uint8_t entry[8];
+    size_t i;
+    int bin, ok = 1;
+    FILE *out;
+
+    if (batch == NULL || path == NULL) {
+        fprintf(stderr, "Invalid batch output arguments\n");
+        return -1;
+    }
+
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    memcpy(header, HISTOGRAM_BATCH_MAGIC, 4);
+    put_le(header + 4, HISTOGRAM_BATCH_VERSION, 4);
+    put_le(header + 8, batch->count, 4);
+    put_le(header + 12, 4, 4);      // bin_bytes: the counts are uint32_t
+    ok = fwrite(header, sizeof(header), 1, out) == 1;
+
+    for (i = 0; ok && i < batch->count; i++) {
+        for (bin = 0; bin < 256; bin++)
+            put_le(record + bin * 4, batch->histograms[i][bin], 4);
+        ok = fwrite(record, sizeof(record), 1, out) == 1;
+    }
+
+    for (i = 0; ok && i < batch->count; i++) {
+        size_t len = strlen(batch->paths[i]);
+        put_le(entry, (uint32_t)batch->status[i], 4);
+        put_le(entry + 4, len, 4);
+        ok = fwrite(entry, sizeof(entry), 1, out) == 1 &&
+             fwrite(batch->paths[i], 1, len, out) == len;
+    }
+
+    if (fclose(out) != 0)
+        ok = 0;
+    if (!ok) {
+        perror("Failed to write batch output");
+        return -1;
+    }
+    return 0;
+}
+
+int histogram_batch_write_csv(const histogram_batch_t *batch, const char *path)
+{
+    size_t i;
+    int bin;
+    FILE *out;
+
+    if (batch == NULL || path == NULL) {
+        fprintf(stderr, "Invalid batch output arguments\n");
+        return -1;
+    }
+
+    out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    fprintf(out, "name,status");
+    for (bin = 0; bin < 256; bin++)
+        fprintf(out, ",b%d", bin);
+    fprintf(out, "\n");
+
+    for (i = 0; i < batch->count; i++) {
+        // Quote names so commas in paths survive
+        fprintf(out, "\"");
+        for (const char *c = batch->paths[i]; *c; c++) {
+            if (*c == '"')
+                fputc('"', out);
+            fputc(*c, out);
+        }
+        fprintf(out, "\",%d", batch->status[i]);
+        for (bin = 0; bin < 256; bin++)
+            fprintf(out, ",%u", batch->histograms[i][bin]);
+        fprintf(out, "\n");
+    }
+
+    if (fclose(out) != 0) {
+        perror("Failed to write batch CSV");
+        return -1;
+    }
+    return 0;
+}
+
+void histogram_batch_free(histogram_batch_t *batch)
+{
+    size_t i;
+
+    if (batch == NULL)
+        return;
+
+    for (i = 0; i < batch->count; i++)
+        free(batch->paths[i]);
+    free(batch->paths);
+    free(batch->sizes);
+    free(batch->histograms);
+    free(batch->status);
+    memset(batch, 0, sizeof(*batch));
+}
@@ -0,0 +1,87 @@
+#ifndef HISTOGRAM_BATCH_H
+#define HISTOGRAM_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Binary batch output format ("HSTB", all integers little-endian)
+ *
+ *     header   char magic[4] = "HSTB"
+ *              u32  version = 1
+ *              u32  count          number of images
+ *              u32  bin_bytes      4: bins are u32
+ *     records  count * 256 bins of bin_bytes each, in index order
+ *     index    count entries of: i32 status, u32 name_len, name bytes
+ *
+ * Records are fixed size, so image i's histogram is at offset
+ * 16 + i * 256 * bin_bytes. Status is 0 for images that were counted,
+ * -1 for images that failed to decode (their bins are zero).
+ */
+#define HISTOGRAM_BATCH_MAGIC   "HSTB"
+#define HISTOGRAM_BATCH_VERSION 1
+
+/**
+ * @brief Count one image; returns 0 on success, -1 on failure
+ *
+ * Called concurrently from several worker threads.
+ */
+typedef int (*histogram_batch_fn)(const char *path, uint32_t histogram[256], void *user);
+
+/**
+ * @brief A batch of images and their histograms
+ */
+typedef struct {
+    size_t count;                 /**< Number of images */
+    char **paths;                 /**< Image paths: sorted for a directory, list order for @file */
+    uint64_t *sizes;              /**< File sizes in bytes */
+    uint32_t (*histograms)[256];  /**< One histogram per image */
+    int *status;                  /**< 0 = counted, -1 = failed */
+    uint64_t total_bytes;         /**< Sum of file sizes */
+    size_t failed;                /**< Images that failed to decode */
+    double seconds;               /**< Wall time of the last run */
+} histogram_batch_t;
+
+/**
+ * @brief Collect the images of a batch
+ *
+ * @param source A directory (walked recursively, image extensions only)
+ *               or "@file" naming a text file with one path per line
+ * @param batch Batch to fill (zeroed first)
+ * @return 0 on success, -1 on failure
+ */
+int histogram_batch_collect(const char *source, histogram_batch_t *batch);
+
+/**
+ * @brief Count every image of the batch on a pool of worker threads
+ *
+ * Workers claim images from a shared counter, so large and small files
+ * balance out.
+ *
+ * @param batch Collected batch
+ * @param threads Worker threads, <= 0 uses all online CPUs
+ * @param fn Decode-and-count callback
+ * @param user Passed through to @p fn
+ * @return 0 if all images were counted, -1 if any failed
+ */
+int histogram_batch_run(histogram_batch_t *batch, int threads,
+                        histogram_batch_fn fn, void *user);
+
+/**
+ * @brief Write the batch results in the binary HSTB format
+ * @return 0 on success, -1 on failure
+ */
+int histogram_batch_write_binary(const histogram_batch_t *batch, const char *path);
+
+/**
+ * @brief Write the batch results as CSV: name,status,bin0..bin255
+ * @return 0 on success, -1 on failure
+ */
+int histogram_batch_write_csv(const histogram_batch_t *batch, const char *path);
+
+/**
+ * @brief Free everything owned by the batch
+ */
+void histogram_batch_free(histogram_batch_t *batch);
+
+#endif // HISTOGRAM_BATCH_H
@@ -0,0 +1,662 @@
+#define _POSIX_C_SOURCE 200809L
+#include "histogram_compute.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HISTOGRAM_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+// Number of interleaved sub-histograms used while counting
+#define HISTOGRAM_SUBHISTS 4
+
+// Pixels converted to gray per block (the gray block stays in L1)
+#define HISTOGRAM_BLOCK 1024
+
+// Target size of a row band handed to a worker thread (about half an L2)
+#define HISTOGRAM_BAND_BYTES (256 * 1024)
+
+// Below this many pixels threads cost more than they save
+#define HISTOGRAM_PARALLEL_MIN_PIXELS (512 * 1024)
+
+// Shared description of a parallel histogram job
+typedef struct {
+    const unsigned char *image_data;
+    int width;
+    int height;
+    int channels;
+    int rows_per_band;
+    int bands;
+    histogram_kernel_t kernel;
+    atomic_int next_band;
+} band_job_t;
+
+// One worker: private bins first, padded to whole cache lines
+typedef struct {
+    _Alignas(64) uint32_t histogram[256];
+    band_job_t *job;
+    pthread_t thread;
+    bool started;
+} band_worker_t;
+
+typedef void (*luma_block_fn)(const uint8_t *pixels, size_t count, int channels,
+                              uint8_t *gray);
+
+static void count_bytes(const uint8_t *values, size_t count,
+                        uint32_t sub[HISTOGRAM_SUBHISTS][256])
+{
+    size_t i = 0;
+
+    // Consecutive pixels go to different sub-histograms so that equal
+    // intensities don't wait on the previous increment of the same counter
+    for (; i + 4 <= count; i += 4) {
+        sub[0][values[i]]++;
+        sub[1][values[i + 1]]++;
+        sub[2][values[i + 2]]++;
+        sub[3][values[i + 3]]++;
+    }
+    for (; i < count; i++) {
+        sub[0][values[i]]++;
+    }
+}
+
+static void count_strided(const uint8_t *values, size_t count, int stride,
+                          uint32_t sub[HISTOGRAM_SUBHISTS][256])
+{
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        sub[0][values[i * stride]]++;
+        sub[1][values[(i + 1) * stride]]++;
+        sub[2][values[(i + 2) * stride]]++;
+        sub[3][values[(i + 3) * stride]]++;
+    }
+    for (; i < count; i++) {
+        sub[0][values[i * stride]]++;
+    }
+}
+
+static void luma_block_scalar(const uint8_t *pixels, size_t count, int channels,
+                              uint8_t *gray)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        const uint8_t *p = pixels + i * channels;
+        gray[i] = HISTOGRAM_LUMA(p[0], p[1], p[2]);
+    }
+}
+
+#ifdef HISTOGRAM_HAVE_X86
+
+/*
+ * Split 16 packed RGB pixels (48 bytes) into R, G and B vectors using only
+ * SSE2 unpacks. Each round of unpacks moves the data one step closer to
+ * planar order; four rounds fully deinterleave the three channels.
+ */
+__attribute__((target("sse2")))
+static inline void deinterleave_rgb16(const uint8_t *src, __m128i *r, __m128i *g, __m128i *b)
+{
+    __m128i t00 = _mm_loadu_si128((const __m128i *)src);
+    __m128i t01 = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i t02 = _mm_loadu_si128((const __m128i *)(src + 32));
+
+    __m128i t10 = _mm_unpacklo_epi8(t00, _mm_unpackhi_epi64(t01, t01));
+    __m128i t11 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t00, t00), t02);
+    __m128i t12 = _mm_unpacklo_epi8(t01, _mm_unpackhi_epi64(t02, t02));
+
+    __m128i t20 = _mm_unpacklo_epi8(t10, _mm_unpackhi_epi64(t11, t11));
+    __m128i t21 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t10, t10), t12);
+    __m128i t22 = _mm_unpacklo_epi8(t11, _mm_unpackhi_epi64(t12, t12));
+
+    __m128i t30 = _mm_unpacklo_epi8(t20, _mm_unpackhi_epi64(t21, t21));
+    __m128i t31 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t20, t20), t22);
+    __m128i t32 = _mm_unpacklo_epi8(t21, _mm_unpackhi_epi64(t22, t22));
+
+    *r = _mm_unpacklo_epi8(t30, _mm_unpackhi_epi64(t31, t31));
+    *g = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t30, t30), t32);
+    *b = _mm_unpacklo_epi8(t31, _mm_unpackhi_epi64(t32, t32));
+}
+
+// Luma of 4 pixels given (R,G) and (B,0) pairs in 16-bit lanes
+__attribute__((target("sse2")))
+static inline __m128i luma4_sse2(__m128i rg, __m128i b0)
+{
+    const __m128i w_rg = _mm_set1_epi32((HISTOGRAM_LUMA_G << 16) | HISTOGRAM_LUMA_R);
+    const __m128i w_b = _mm_set1_epi32(HISTOGRAM_LUMA_B);
+
+    return _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(rg, w_rg),
+                                        _mm_madd_epi16(b0, w_b)),
+                          HISTOGRAM_LUMA_SHIFT);
+}
+
+__attribute__((target("sse2")))
+static void luma_block_sse2(const uint8_t *pixels, size_t count, int channels,
+                            uint8_t *gray)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    if (channels == 3) {
+        for (; i + 16 <= count; i += 16) {
+            __m128i r, g, b;
+            deinterleave_rgb16(pixels + i * 3, &r, &g, &b);
+
+            __m128i r_lo = _mm_unpacklo_epi8(r, zero), r_hi = _mm_unpackhi_epi8(r, zero);
+            __m128i g_lo = _mm_unpacklo_epi8(g, zero), g_hi = _mm_unpackhi_epi8(g, zero);
+            __m128i b_lo = _mm_unpacklo_epi8(b, zero), b_hi = _mm_unpackhi_epi8(b, zero);
+
+            __m128i y0 = luma4_sse2(_mm_unpacklo_epi16(r_lo, g_lo), _mm_unpacklo_epi16(b_lo, zero));
+            __m128i y1 = luma4_sse2(_mm_unpackhi_epi16(r_lo, g_lo), _mm_unpackhi_epi16(b_lo, zero));
+            __m128i y2 = luma4_sse2(_mm_unpacklo_epi16(r_hi, g_hi), _mm_unpacklo_epi16(b_hi, zero));
+            __m128i y3 = luma4_sse2(_mm_unpackhi_epi16(r_hi, g_hi), _mm_unpackhi_epi16(b_hi, zero));
+
+            _mm_storeu_si128((__m128i *)(gray + i),
+                             _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3)));
+        }
+    } else if (channels == 4) {
+        const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+        const __m128i w_rb = _mm_set1_epi32((HISTOGRAM_LUMA_B << 16) | HISTOGRAM_LUMA_R);
+        const __m128i w_g = _mm_set1_epi32(HISTOGRAM_LUMA_G);
+
+        for (; i + 16 <= count; i += 16) {
+            __m128i y[4];
+            int k;
+
+            // Each 32-bit lane is one RGBA pixel: (R,B) in the low bytes of
+            // the 16-bit halves, (G,A) in the high bytes
+            for (k = 0; k < 4; k++) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(pixels + (i + 4 * k) * 4));
+                __m128i rb = _mm_and_si128(v, low_bytes);
+                __m128i ga = _mm_srli_epi16(v, 8);
+                y[k] = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(rb, w_rb),
+                                                    _mm_madd_epi16(ga, w_g)),
+                                      HISTOGRAM_LUMA_SHIFT);
+            }
+
+            _mm_storeu_si128((__m128i *)(gray + i),
+                             _mm_packus_epi16(_mm_packs_epi32(y[0], y[1]),
+                                              _mm_packs_epi32(y[2], y[3])));
+        }
+    }
+
+    luma_block_scalar(pixels + i * channels, count - i, channels, gray + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i luma8_avx2(__m256i rg, __m256i b0)
+{
+    const __m256i w_rg = _mm256_set1_epi32((HISTOGRAM_LUMA_G << 16) | HISTOGRAM_LUMA_R);
+    const __m256i w_b = _mm256_set1_epi32(HISTOGRAM_LUMA_B);
+
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg, w_rg),
+                                              _mm256_madd_epi16(b0, w_b)),
+                             HISTOGRAM_LUMA_SHIFT);
+}
+
+// Narrow 16 luma values held in two 8x32-bit vectors (in lane order
+// [0-3|8-11] and [4-7|12-15]) back to 16 bytes in pixel order
+__attribute__((target("avx2")))
+static inline __m128i narrow16_avx2(__m256i lo, __m256i hi)
+{
+    __m256i y16 = _mm256_packs_epi32(lo, hi);
+
+    return _mm_packus_epi16(_mm256_castsi256_si128(y16), _mm256_extracti128_si256(y16, 1));
+}
+
+__attribute__((target("avx2")))
+static void luma_block_avx2(const uint8_t *pixels, size_t count, int channels,
+                            uint8_t *gray)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    if (channels == 3) {
+        for (; i + 16 <= count; i += 16) {
+            __m128i r, g, b;
+            deinterleave_rgb16(pixels + i * 3, &r, &g, &b);
+
+            __m256i r16 = _mm256_cvtepu8_epi16(r);
+            __m256i g16 = _mm256_cvtepu8_epi16(g);
+            __m256i b16 = _mm256_cvtepu8_epi16(b);
+
+            __m256i lo = luma8_avx2(_mm256_unpacklo_epi16(r16, g16), _mm256_unpacklo_epi16(b16, zero));
+            __m256i hi = luma8_avx2(_mm256_unpackhi_epi16(r16, g16), _mm256_unpackhi_epi16(b16, zero));
+
+            _mm_storeu_si128((__m128i *)(gray + i), narrow16_avx2(lo, hi));
+        }
+    } else if (channels == 4) {
+        const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+        const __m256i w_rb = _mm256_set1_epi32((HISTOGRAM_LUMA_B << 16) | HISTOGRAM_LUMA_R);
+        const __m256i w_g = _mm256_set1_epi32(HISTOGRAM_LUMA_G);
+
+        for (; i + 16 <= count; i += 16) {
+            __m256i v0 = _mm256_loadu_si256((const __m256i *)(pixels + i * 4));
+            __m256i v1 = _mm256_loadu_si256((const __m256i *)(pixels + (i + 8) * 4));
+            __m256i y0 = _mm256_srli_epi32(_mm256_add_epi32(
+                             _mm256_madd_epi16(_mm256_and_si256(v0, low_bytes), w_rb),
+                             _mm256_madd_epi16(_mm256_srli_epi16(v0, 8), w_g)),
+                             HISTOGRAM_LUMA_SHIFT);
+            __m256i y1 = _mm256_srli_epi32(_mm256_add_epi32(
+                             _mm256_madd_epi16(_mm256_and_si256(v1, low_bytes), w_rb),
+                             _mm256_madd_epi16(_mm256_srli_epi16(v1, 8), w_g)),
+                             HISTOGRAM_LUMA_SHIFT);
+
+            // y0 = [0-3|4-7], y1 = [8-11|12-15]; regroup the 128-bit halves
+            // into the [0-3|8-11], [4-7|12-15] order narrow16_avx2() expects
+            __m256i lo = _mm256_permute2x128_si256(y0, y1, 0x20);
+            __m256i hi = _mm256_permute2x128_si256(y0, y1, 0x31);
+
+            _mm_storeu_si128((__m128i *)(gray + i), narrow16_avx2(lo, hi));
+        }
+    }
+
+    luma_block_scalar(pixels + i * channels, count - i, channels, gray + i);
+}
+
+#endif // HISTOGRAM_HAVE_X86
+
+histogram_kernel_t histogram_kernel_resolve(histogram_kernel_t kernel)
+{
+#ifdef HISTOGRAM_HAVE_X86
+    int has_avx2 = __builtin_cpu_supports("avx2");
+    int has_sse2 = __builtin_cpu_supports("sse2");
+
+    if (kernel == HISTOGRAM_KERNEL_SCALAR)
+        return HISTOGRAM_KERNEL_SCALAR;
+    if (kernel == HISTOGRAM_KERNEL_SSE2 && has_sse2)
+        return HISTOGRAM_KERNEL_SSE2;
+    if (kernel == HISTOGRAM_KERNEL_AVX2 && has_avx2)
+        return HISTOGRAM_KERNEL_AVX2;
+
+    if (has_avx2)
+        return HISTOGRAM_KERNEL_AVX2;
+    if (has_sse2)
+        return HISTOGRAM_KERNEL_SSE2;
+#else
+    (void)kernel;
+#endif
+    return HISTOGRAM_KERNEL_SCALAR;
+}
+
+const char *histogram_kernel_name(histogram_kernel_t kernel)
+{
+    switch (kernel) {
+    case HISTOGRAM_KERNEL_SCALAR: return "scalar";
+    case HISTOGRAM_KERNEL_SSE2:   return "sse2";
+    case HISTOGRAM_KERNEL_AVX2:   return "avx2";
+    default:                      return "auto";
+    }
+}
+
+static luma_block_fn luma_block_for(histogram_kernel_t kernel)
+{
+#ifdef HISTOGRAM_HAVE_X86
+    switch (histogram_kernel_resolve(kernel)) {
+    case HISTOGRAM_KERNEL_AVX2: return luma_block_avx2;
+    case HISTOGRAM_KERNEL_SSE2: return luma_block_sse2;
+    default:                    break;
+    }
+#else
+    (void)kernel;
+#endif
+    return luma_block_scalar;
+}
+
+static void accumulate_kernel(const unsigned char *pixels, size_t count, int channels,
+                              uint32_t histogram[256], histogram_kernel_t kernel)
+{
+    uint32_t sub[HISTOGRAM_SUBHISTS][256];
+    uint8_t gray[HISTOGRAM_BLOCK];
+    size_t done, n;
+    int i, k;
+
+    if (pixels == NULL || count == 0 || channels < 1 || channels > 4)
+        return;
+
+    memset(sub, 0, sizeof(sub));
+
+    if (channels == 1) {
+        count_bytes(pixels, count, sub);
+    } else if (channels == 2) {
+        count_strided(pixels, count, channels, sub);
+    } else {
+        luma_block_fn luma_block = luma_block_for(kernel);
+
+        for (done = 0; done < count; done += n) {
+            n = count - done;
+            if (n > HISTOGRAM_BLOCK)
+                n = HISTOGRAM_BLOCK;
+            luma_block(pixels + done * channels, n, channels, gray);
+            count_bytes(gray, n, sub);
+        }
+    }
+
+    // Merge sub-histograms
+    for (i = 0; i < 256; i++) {
+        uint32_t total = 0;
+        for (k = 0; k < HISTOGRAM_SUBHISTS; k++)
+            total += sub[k][i];
+        histogram[i] += total;
+    }
+}
+
+void histogram_accumulate(const unsigned char *pixels, size_t count, int channels,
+                          uint32_t histogram[256])
+{
+    accumulate_kernel(pixels, count, channels, histogram, HISTOGRAM_KERNEL_AUTO);
+}
+
+size_t histogram_accumulate_strided(const unsigned char *pixels, size_t count, int channels,
+                                    int stride, uint32_t histogram[256])
+{
+    uint32_t sub[HISTOGRAM_SUBHISTS][256];
+    size_t samples, i;
+    int k;
+
+    if (stride <= 1) {
+        histogram_accumulate(pixels, count, channels, histogram);
+        return count;
+    }
+    if (pixels == NULL || count == 0 || channels < 1 || channels > 4)
+        return 0;
+
+    samples = (count + stride - 1) / stride;
+
+    if (channels < 3) {
+        memset(sub, 0, sizeof(sub));
+        count_strided(pixels, samples, stride * channels, sub);
+        for (i = 0; i < 256; i++) {
+            for (k = 0; k < HISTOGRAM_SUBHISTS; k++)
+                histogram[i] += sub[k][i];
+        }
+    } else {
+        for (i = 0; i < samples; i++) {
+            const uint8_t *p = pixels + i * stride * channels;
+            histogram[HISTOGRAM_LUMA(p[0], p[1], p[2])]++;
+        }
+    }
+
+    return samples;
+}
+
+double histogram_distance(const uint32_t a[256], const uint32_t b[256])
+{
+    uint64_t total_a = 0, total_b = 0;
+    double distance = 0.0;
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        total_a += a[i];
+        total_b += b[i];
+    }
+    if (total_a == 0 || total_b == 0)
+        return total_a == total_b ? 0.0 : 1.0;
+
+    for (i = 0; i < 256; i++)
+        distance += fabs((double)a[i] / total_a - (double)b[i] / total_b);
+
+    return distance / 2.0;
+}
+
+double histogram_sampling_bound(uint64_t samples, double confidence)
+{
+    if (samples == 0 || confidence <= 0.0 || confidence >= 1.0)
+        return 1.0;
+
+    // DKW: P(sup |F_n - F| > e) <= 2 exp(-2 n e^2). A bin range is the
+    // difference of two CDF values, hence the factor 2.
+    return 2.0 * sqrt(log(2.0 / (1.0 - confidence)) / (2.0 * (double)samples));
+}
+
+void compute_histogram_kernel(const unsigned char *image_data, int width, int height,
+                              int channels, uint32_t histogram[256],
+                              histogram_kernel_t kernel)
+{
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+
+    if (width <= 0 || height <= 0)
+        return;
+
+    accumulate_kernel(image_data, (size_t)width * height, channels, histogram, kernel);
+}
+
+void compute_histogram(const unsigned char *image_data, int width, int height,
+                       int channels, uint32_t histogram[256])
+{
+    compute_histogram_kernel(image_data, width, height, channels, histogram,
+                             HISTOGRAM_KERNEL_AUTO);
+}
+
+static void *band_worker_run(void *arg)
+{
+    band_worker_t *worker = (band_worker_t *)arg;
+    band_job_t *job = worker->job;
+    size_t row_bytes = (size_t)job->width * job->channels;
+    int band, first_row, rows;
+
+    // Bands are claimed dynamically so a slow core doesn't hold up the rest
+    while ((band = atomic_fetch_add_explicit(&job->next_band, 1, memory_order_relaxed)) < job->bands) {
+        first_row = band * job->rows_per_band;
+        rows = job->height - first_row;
+        if (rows > job->rows_per_band)
+            rows = job->rows_per_band;
+
+        accumulate_kernel(job->image_data + (size_t)first_row * row_bytes,
+                          (size_t)rows * job->width, job->channels,
+                          worker->histogram, job->kernel);
+    }
+
+    return NULL;
+}
+
+int histogram_default_threads(void)
+{
+    const char *env = getenv(HISTOGRAM_THREADS_ENV);
+    char *end;
+    long value;
+
+    if (env == NULL || *env == '\0')
+        return 1;
+
+    value = strtol(env, &end, 10);
+    if (*end != '\0' || value < 0 || value > HISTOGRAM_MAX_THREADS)
+        return 1;
+
+    return (int)value;
+}
+
+void compute_histogram_parallel(const unsigned char *image_data, int width, int height,
+                                int channels, uint32_t histogram[256],
+                                histogram_kernel_t kernel, int threads)
+{
+    band_job_t job;
+    band_worker_t *workers;
+    size_t row_bytes;
+    int i, t;
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    if (threads == 1 || width <= 0 || height <= 0 ||
+        (size_t)width * height < HISTOGRAM_PARALLEL_MIN_PIXELS) {
+        compute_histogram_kernel(image_data, width, height, channels, histogram, kernel);
+        return;
+    }
+
+    row_bytes = (size_t)width * channels;
+    job.image_data = image_data;
+    job.width = width;
+    job.height = height;
+    job.channels = channels;
+    job.rows_per_band = row_bytes >= HISTOGRAM_BAND_BYTES ? 1 : (int)(HISTOGRAM_BAND_BYTES / row_bytes);
+    job.bands = (height + job.rows_per_band - 1) / job.rows_per_band;
+    job.kernel = histogram_kernel_resolve(kernel);
+    atomic_init(&job.next_band, 0);
+
+    if (threads > job.bands)
+        threads = job.bands;
+
+    workers = aligned_alloc(_Alignof(band_worker_t), threads * sizeof(band_worker_t));
+    if (workers == NULL) {
+        compute_histogram_kernel(image_data, width, height, channels, histogram, kernel);
+        return;
+    }
+    memset(workers, 0, threads * sizeof(band_worker_t));
+
+    // Worker 0 is the calling thread; if a thread fails to start the
+    // remaining workers simply take more bands
+    for (t = 1; t < threads; t++) {
+        workers[t].job = &job;
+        workers[t].started = pthread_create(&workers[t].thread, NULL,
+                                            band_worker_run, &workers[t]) == 0;
+    }
+    workers[0].job = &job;
+    band_worker_run(&workers[0]);
+
+    // Reduce private histograms
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+    for (t = 0; t < threads; t++) {
+        if (t > 0 && workers[t].started)
+            pthread_join(workers[t].thread, NULL);
+        for (i = 0; i < 256; i++)
+            histogram[i] += workers[t].histogram[i];
+    }
+
+    free(workers);
+}
+
+// Quantized HSV hue of a chromatic pixel (max != min), integer only
+static inline int hue_bin(int r, int g, int b, int hue_bins)
+{
+    int max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+    int min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+    int delta = max - min;
+    int h;  // hue in sixths of a turn, scaled by delta: [0, 6 * delta)
+
+    if (max == r) {
+        h = g - b;
+        if (h < 0)
+            h += 6 * delta;
+    } else if (max == g) {
+        h = 2 * delta + b - r;
+    } else {
+        h = 4 * delta + r - g;
+    }
+
+    return (h * hue_bins) / (6 * delta);
+}
+
+int compute_histogram_multi(const unsigned char *image_data, int width, int height,
+                            int channels, int hue_bins, histogram_multi_t *multi)
+{
+    size_t total, i;
+
+    if (image_data == NULL || multi == NULL || width <= 0 || height <= 0 ||
+        channels < 1 || channels > 4)
+        return -1;
+    if (hue_bins < 0 || hue_bins > 256 || (hue_bins & (hue_bins - 1)) != 0)
+        return -1;
+
+    memset(multi, 0, sizeof(*multi));
+    multi->hue_bins = hue_bins;
+    total = (size_t)width * height;
+
+    if (channels < 3) {
+        for (i = 0; i < total; i++) {
+            uint32_t *row = multi->bins[image_data[i * channels]];
+            row[0]++;
+            row[1]++;
+            row[2]++;
+            row[3]++;
+        }
+        multi->achromatic = (uint32_t)total;
+        return 0;
+    }
+
+    for (i = 0; i < total; i++) {
+        const uint8_t *p = image_data + i * channels;
+        int r = p[0], g = p[1], b = p[2];
+
+        multi->bins[r][HISTOGRAM_CHANNEL_RED]++;
+        multi->bins[g][HISTOGRAM_CHANNEL_GREEN]++;
+        multi->bins[b][HISTOGRAM_CHANNEL_BLUE]++;
+        multi->bins[HISTOGRAM_LUMA(r, g, b)][HISTOGRAM_CHANNEL_LUMA]++;
+
+        if (hue_bins > 0) {
+            if (r == g && g == b)
+                multi->achromatic++;
+            else
+                multi->hue[hue_bin(r, g, b, hue_bins)]++;
+        }
+    }
+
+    return 0;
+}
+
+int histogram_multi_extract(const histogram_multi_t *multi, histogram_channel_t channel,
+                            uint32_t histogram[256])
+{
+    int i, k, span;
+
+    if (multi == NULL || histogram == NULL)
+        return -1;
+
+    if (channel == HISTOGRAM_CHANNEL_HUE) {
+        if (multi->hue_bins <= 0)
+            return -1;
+
+        span = 256 / multi->hue_bins;
+        for (i = 0; i < multi->hue_bins; i++) {
+            for (k = 0; k < span; k++) {
+                // Remainder goes to the first slot so the bin total is kept
+                histogram[i * span + k] = multi->hue[i] / span +
+                                          (k == 0 ? multi->hue[i] % span : 0);
+            }
+        }
+        return 0;
+    }
+
+    if (channel < HISTOGRAM_CHANNEL_RED || channel > HISTOGRAM_CHANNEL_LUMA)
+        return -1;
+
+    for (i = 0; i < 256; i++)
+        histogram[i] = multi->bins[i][channel];
+    return 0;
+}
+
+void compute_histogram_reference(const unsigned char *image_data, int width, int height,
+                                 int channels, uint32_t histogram[256])
+{
+    // Initialize histogram to zero
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+
+    // Count pixel intensities
+    size_t total_pixels = (size_t)width * height;
+    for (size_t i = 0; i < total_pixels; i++) {
+        // Calculate grayscale value from RGB
+        size_t pixel_index = i * channels;
+        int gray_value;
+
+        if (channels >= 3) {
+            // Convert RGB to grayscale using luminance formula
+            int r = image_data[pixel_index];
+            int g = image_data[pixel_index + 1];
+            int b = image_data[pixel_index + 2];
+            gray_value = (int)(0.299 * r + 0.587 * g + 0.114 * b);
+        } else {
+            // Grayscale image
+            gray_value = image_data[pixel_index];
+        }
+
+        histogram[gray_value]++;
+    }
+}
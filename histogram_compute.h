@@ -0,0 +1,243 @@
+#ifndef HISTOGRAM_COMPUTE_H
+#define HISTOGRAM_COMPUTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Fixed-point luminance weights (BT.601) in Q15
+ *
+ * Rounding rule used by every kernel (scalar, SSE2 and AVX2):
+ *
+ *     gray = (9798 * R + 19235 * G + 3735 * B) >> 15
+ *
+ * The weights are round(0.299 * 2^15), round(0.587 * 2^15) and
+ * round(0.114 * 2^15) adjusted so they add up to exactly 2^15, so a
+ * neutral pixel (R == G == B == v) always maps to v. The result is
+ * truncated toward zero, like the previous (int) cast of the double
+ * expression. All kernels produce bit-identical histograms.
+ */
+#define HISTOGRAM_LUMA_R     9798
+#define HISTOGRAM_LUMA_G     19235
+#define HISTOGRAM_LUMA_B     3735
+#define HISTOGRAM_LUMA_SHIFT 15
+
+#define HISTOGRAM_LUMA(r, g, b) \
+    ((uint8_t)((HISTOGRAM_LUMA_R * (uint32_t)(r) + \
+                HISTOGRAM_LUMA_G * (uint32_t)(g) + \
+                HISTOGRAM_LUMA_B * (uint32_t)(b)) >> HISTOGRAM_LUMA_SHIFT))
+
+/**
+ * @brief Pixel kernels available to compute_histogram()
+ */
+typedef enum {
+    HISTOGRAM_KERNEL_AUTO = 0,  /**< Best kernel supported by the CPU */
+    HISTOGRAM_KERNEL_SCALAR,    /**< Portable C fallback */
+    HISTOGRAM_KERNEL_SSE2,      /**< x86 SSE2 */
+    HISTOGRAM_KERNEL_AVX2       /**< x86 AVX2 */
+} histogram_kernel_t;
+
+/**
+ * @brief Compute the 256-bin luminance histogram of an image
+ *
+ * Pixels with 3 or more channels are converted with HISTOGRAM_LUMA();
+ * 1 and 2 channel images use the first channel directly. Counting is
+ * done into several interleaved sub-histograms that are merged at the
+ * end, so runs of equal intensities don't serialize on one counter.
+ *
+ * @param image_data Interleaved pixel data (width * height * channels bytes)
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param channels Bytes per pixel (1 to 4)
+ * @param histogram Output histogram (overwritten)
+ */
+void compute_histogram(const unsigned char *image_data, int width, int height,
+                       int channels, uint32_t histogram[256]);
+
+/**
+ * @brief Same as compute_histogram() but with an explicit kernel
+ *
+ * Requesting a kernel the CPU doesn't support falls back to the best
+ * supported one.
+ */
+void compute_histogram_kernel(const unsigned char *image_data, int width, int height,
+                              int channels, uint32_t histogram[256],
+                              histogram_kernel_t kernel);
+
+/**
+ * @brief Add the luminance of a run of pixels to a histogram
+ *
+ * Unlike compute_histogram() this accumulates into @p histogram instead
+ * of clearing it, so it can be fed one row (or band) at a time.
+ *
+ * @param pixels Interleaved pixel data (count * channels bytes)
+ * @param count Number of pixels
+ * @param channels Bytes per pixel (1 to 4)
+ * @param histogram Histogram to accumulate into
+ */
+void histogram_accumulate(const unsigned char *pixels, size_t count, int channels,
+                          uint32_t histogram[256]);
+
+/**
+ * @brief Environment variable read by histogram_default_threads()
+ */
+#define HISTOGRAM_THREADS_ENV "HISTOGRAM_THREADS"
+
+/**
+ * @brief Largest thread count accepted from the environment or command line
+ */
+#define HISTOGRAM_MAX_THREADS 1024
+
+/**
+ * @brief Compute the histogram using several threads
+ *
+ * The image is split into row bands of roughly L2 size. Workers take
+ * bands from a shared counter and count them into their own private
+ * 256-bin array, so the hot loop shares nothing. The private arrays are
+ * added up at the end. The result is identical to compute_histogram_kernel().
+ * Small images are counted on the calling thread.
+ *
+ * @param image_data Interleaved pixel data (width * height * channels bytes)
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param channels Bytes per pixel (1 to 4)
+ * @param histogram Output histogram (overwritten)
+ * @param kernel Pixel kernel used by every worker
+ * @param threads Number of threads including the caller; <= 0 uses all
+ *                online CPUs
+ */
+void compute_histogram_parallel(const unsigned char *image_data, int width, int height,
+                                int channels, uint32_t histogram[256],
+                                histogram_kernel_t kernel, int threads);
+
+/**
+ * @brief Thread count requested through HISTOGRAM_THREADS
+ * @return Value of the variable (0 meaning all CPUs), or 1 if unset/invalid
+ */
+int histogram_default_threads(void);
+
+/**
+ * @brief Accumulate every @p stride-th pixel of a run of pixels
+ *
+ * Used for sampled (approximate) histograms. A stride of 1 is the same
+ * as histogram_accumulate().
+ *
+ * @param pixels Interleaved pixel data (count * channels bytes)
+ * @param count Number of pixels in the run
+ * @param channels Bytes per pixel (1 to 4)
+ * @param stride Distance between sampled pixels (>= 1)
+ * @param histogram Histogram to accumulate into
+ * @return Number of pixels sampled
+ */
+size_t histogram_accumulate_strided(const unsigned char *pixels, size_t count, int channels,
+                                    int stride, uint32_t histogram[256]);
+
+/**
+ * @brief Total variation distance between two histograms
+ *
+ * Both histograms are normalized to their own totals first, so a sampled
+ * histogram can be compared with the exact one.
+ *
+ * @return Distance in [0, 1]: the fraction of pixels that would have to
+ *         move to another bin to turn one distribution into the other
+ */
+double histogram_distance(const uint32_t a[256], const uint32_t b[256]);
+
+/**
+ * @brief Error bound for a histogram built from random-like samples
+ *
+ * Uses the Dvoretzky-Kiefer-Wolfowitz inequality. With probability
+ * @p confidence, the share of pixels in any range of consecutive bins
+ * (a bin, or a display column) is within the returned value of the
+ * exact share.
+ *
+ * @param samples Number of sampled pixels
+ * @param confidence Confidence level, e.g. 0.95
+ * @return Maximum absolute error of a bin-range share
+ */
+double histogram_sampling_bound(uint64_t samples, double confidence);
+
+/**
+ * @brief Histograms produced by compute_histogram_multi()
+ */
+typedef enum {
+    HISTOGRAM_CHANNEL_RED = 0,
+    HISTOGRAM_CHANNEL_GREEN,
+    HISTOGRAM_CHANNEL_BLUE,
+    HISTOGRAM_CHANNEL_LUMA,
+    HISTOGRAM_CHANNEL_HUE
+} histogram_channel_t;
+
+/**
+ * @brief Number of intensity histograms interleaved in histogram_multi_t
+ */
+#define HISTOGRAM_MULTI_BANDS 4
+
+/**
+ * @brief Single-pass multi-channel histogram set
+ *
+ * R, G, B and luma counters for the same intensity share one 16-byte row
+ * (bins[intensity][channel]), so on typical images, where the channels
+ * are correlated, the four increments for a pixel hit the same cache
+ * line.
+ */
+typedef struct {
+    uint32_t bins[256][HISTOGRAM_MULTI_BANDS];  /**< [intensity][R, G, B, luma] */
+    uint32_t hue[256];      /**< Quantized HSV hue, first hue_bins entries used */
+    int hue_bins;           /**< Hue bins (power of two up to 256), 0 = no hue */
+    uint32_t achromatic;    /**< Pixels without a hue (R == G == B) */
+} histogram_multi_t;
+
+/**
+ * @brief Compute R, G, B, luma and optionally hue histograms in one pass
+ *
+ * Gray images (1 or 2 channels) count their value into all four
+ * intensity histograms and have no hue. Hue bin k covers hues in
+ * [k * 360 / hue_bins, (k + 1) * 360 / hue_bins) degrees and is computed
+ * with integer math.
+ *
+ * @param image_data Interleaved pixel data (width * height * channels bytes)
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param channels Bytes per pixel (1 to 4)
+ * @param hue_bins Hue bins to compute (power of two up to 256), 0 to skip hue
+ * @param multi Output histogram set (overwritten)
+ * @return 0 on success, -1 on invalid arguments
+ */
+int compute_histogram_multi(const unsigned char *image_data, int width, int height,
+                            int channels, int hue_bins, histogram_multi_t *multi);
+
+/**
+ * @brief Copy one histogram out of a multi-channel set as 256 bins
+ *
+ * Hue bins are spread evenly over the 256 output bins (each bin's count
+ * split across 256 / hue_bins slots), so histogram_dimension() shows the
+ * hue histogram with the same shape as any other.
+ *
+ * @return 0 on success, -1 if the channel wasn't computed
+ */
+int histogram_multi_extract(const histogram_multi_t *multi, histogram_channel_t channel,
+                            uint32_t histogram[256]);
+
+/**
+ * @brief Resolve HISTOGRAM_KERNEL_AUTO (or an unsupported kernel) to the
+ * kernel that will actually run on this CPU
+ */
+histogram_kernel_t histogram_kernel_resolve(histogram_kernel_t kernel);
+
+/**
+ * @brief Human-readable kernel name ("scalar", "sse2", "avx2")
+ */
+const char *histogram_kernel_name(histogram_kernel_t kernel);
+
+/**
+ * @brief Original double-precision loop, kept as the benchmark baseline
+ *
+ * Uses (int)(0.299 * r + 0.587 * g + 0.114 * b) and a single counter
+ * array. It can differ from HISTOGRAM_LUMA() by at most one level, on
+ * about 0.13% of RGB colours (22363 of 2^24).
+ */
+void compute_histogram_reference(const unsigned char *image_data, int width, int height,
+                                 int channels, uint32_t histogram[256]);
+
+#endif // HISTOGRAM_COMPUTE_H
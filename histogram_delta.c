@@ -0,0 +1,197 @@
+#include "histogram_delta.h"
+#include "histogram_compute.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Pixels compared per block; 16 * channels bytes is a whole number of
+// 16-byte vectors for every supported channel count
+#define DELTA_BLOCK_PIXELS 16
+
+struct histogram_delta {
+    int width;
+    int height;
+    int channels;
+    size_t pixels;
+    uint64_t max_changed;   // recount once more pixels than this changed
+    bool primed;            // previous frame and histogram are valid
+    uint8_t *previous;
+    uint32_t histogram[256];
+    histogram_delta_stats_t stats;
+};
+
+static inline uint8_t pixel_luma(const uint8_t *p, int channels)
+{
+    return channels >= 3 ? HISTOGRAM_LUMA(p[0], p[1], p[2]) : p[0];
+}
+
+// True if the two blocks of 16 * channels bytes differ anywhere
+static inline bool block_differs(const uint8_t *a, const uint8_t *b, int channels)
+{
+#ifdef __SSE2__
+    __m128i diff = _mm_setzero_si128();
+    int k;
+
+    for (k = 0; k < channels; k++) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + 16 * k));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + 16 * k));
+        diff = _mm_or_si128(diff, _mm_xor_si128(va, vb));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+#else
+    uint64_t diff = 0, wa, wb;
+    int k;
+
+    for (k = 0; k < 2 * channels; k++) {
+        memcpy(&wa, a + 8 * k, sizeof(wa));
+        memcpy(&wb, b + 8 * k, sizeof(wb));
+        diff |= wa ^ wb;
+    }
+    return diff != 0;
+#endif
+}
+
+// Move changed pixels of a run between bins; returns how many changed
+static size_t apply_run(histogram_delta_t *delta, uint8_t *old, const uint8_t *cur, size_t count)
+{
+    int channels = delta->channels;
+    size_t changed = 0, i;
+
+    if (channels == 1) {
+        for (i = 0; i < count; i++) {
+            if (old[i] != cur[i]) {
+                delta->histogram[old[i]]--;
+                delta->histogram[cur[i]]++;
+                old[i] = cur[i];
+                changed++;
+            }
+        }
+        return changed;
+    }
+
+    for (i = 0; i < count; i++) {
+        const uint8_t *p_old = old + i * channels;
+        const uint8_t *p_new = cur + i * channels;
+
+        if (memcmp(p_old, p_new, channels) != 0) {
+            delta->histogram[pixel_luma(p_old, channels)]--;
+            delta->histogram[pixel_luma(p_new, channels)]++;
+            changed++;
+        }
+    }
+
+    memcpy(old, cur, count * channels);
+    return changed;
+}
+
+static void full_recount(histogram_delta_t *delta, const uint8_t *frame)
+{
+    compute_histogram(frame, delta->width, delta->height, delta->channels, delta->histogram);
+    memcpy(delta->previous, frame, delta->pixels * delta->channels);
+    delta->primed = true;
+    delta->stats.recounts++;
+}
+
+/*
+ * Diff the new frame against the previous one, updating the histogram and
+ * the stored frame as it goes. Returns the number of changed pixels, or -1
+ * as soon as more than max_changed pixels have changed.
+ */
+static int64_t delta_scan(histogram_delta_t *delta, const uint8_t *frame)
+{
+    int channels = delta->channels;
+    size_t pixel, offset, changed = 0;
+
+    for (pixel = 0; pixel + DELTA_BLOCK_PIXELS <= delta->pixels; pixel += DELTA_BLOCK_PIXELS) {
+        offset = pixel * channels;
+        if (!block_differs(delta->previous + offset, frame + offset, channels))
+            continue;
+
+        changed += apply_run(delta, delta->previous + offset, frame + offset, DELTA_BLOCK_PIXELS);
+        if (changed > delta->max_changed)
+            return -1;  // busy scene: a straight recount is cheaper
+    }
+
+    // Tail that doesn't fill a whole block
+    offset = pixel * channels;
+    changed += apply_run(delta, delta->previous + offset, frame + offset, delta->pixels - pixel);
+
+    return changed > delta->max_changed ? -1 : (int64_t)changed;
+}
+
+histogram_delta_t *histogram_delta_create(int width, int height, int channels,
+                                          double threshold)
+{
+    histogram_delta_t *delta;
+
+    if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+        fprintf(stderr, "Invalid frame geometry: %dx%dx%d\n", width, height, channels);
+        return NULL;
+    }
+
+    delta = calloc(1, sizeof(*delta));
+    if (delta == NULL) {
+        perror("Failed to allocate delta engine");
+        return NULL;
+    }
+
+    if (threshold <= 0.0 || threshold > 1.0)
+        threshold = HISTOGRAM_DELTA_DEFAULT_THRESHOLD;
+
+    delta->width = width;
+    delta->height = height;
+    delta->channels = channels;
+    delta->pixels = (size_t)width * height;
+    delta->max_changed = (uint64_t)(threshold * (double)delta->pixels);
+    delta->previous = malloc(delta->pixels * channels);
+    if (delta->previous == NULL) {
+        perror("Failed to allocate previous frame");
+        free(delta);
+        return NULL;
+    }
+
+    return delta;
+}
+
+int64_t histogram_delta_update(histogram_delta_t *delta, const uint8_t *frame,
+                               uint32_t histogram[256])
+{
+    int64_t changed;
+
+    if (delta == NULL || frame == NULL || histogram == NULL)
+        return -1;
+
+    delta->stats.frames++;
+    delta->stats.total_pixels += delta->pixels;
+
+    changed = delta->primed ? delta_scan(delta, frame) : -1;
+    if (changed < 0) {
+        full_recount(delta, frame);
+        changed = (int64_t)delta->pixels;
+    } else {
+        delta->stats.changed_pixels += (uint64_t)changed;
+    }
+
+    memcpy(histogram, delta->histogram, sizeof(delta->histogram));
+    return changed;
+}
+
+void histogram_delta_get_stats(const histogram_delta_t *delta, histogram_delta_stats_t *stats)
+{
+    if (delta == NULL || stats == NULL)
+        return;
+    *stats = delta->stats;
+}
+
+void histogram_delta_destroy(histogram_delta_t *delta)
+{
+    if (delta == NULL)
+        return;
+    free(delta->previous);
+    free(delta);
+}
@@ -0,0 +1,67 @@
+#ifndef HISTOGRAM_DELTA_H
+#define HISTOGRAM_DELTA_H
+
+#include <stdint.h>
+
+/**
+ * @brief Default fraction of changed pixels above which a frame is recounted
+ */
+#define HISTOGRAM_DELTA_DEFAULT_THRESHOLD 0.35
+
+/**
+ * @brief Incremental histogram engine for mostly-static video
+ */
+typedef struct histogram_delta histogram_delta_t;
+
+/**
+ * @brief Counters kept by the delta engine
+ */
+typedef struct {
+    uint64_t frames;          /**< Frames processed */
+    uint64_t recounts;        /**< Frames that needed a full recount */
+    uint64_t changed_pixels;  /**< Pixels updated incrementally (recounts not included) */
+    uint64_t total_pixels;    /**< Pixels in all processed frames */
+} histogram_delta_stats_t;
+
+/**
+ * @brief Create a delta engine for frames of a fixed geometry
+ *
+ * @param width Frame width in pixels
+ * @param height Frame height in pixels
+ * @param channels Bytes per pixel (1 to 4)
+ * @param threshold Fraction of changed pixels (0..1) at which the engine
+ *                  gives up on deltas and recounts the whole frame
+ * @return Engine handle, or NULL on failure
+ */
+histogram_delta_t *histogram_delta_create(int width, int height, int channels,
+                                          double threshold);
+
+/**
+ * @brief Update the histogram with a new frame
+ *
+ * The new frame is compared with the previous one in SIMD-width blocks
+ * of 16 pixels. For each changed pixel the old intensity's bin is
+ * decremented and the new one's incremented. Unchanged blocks cost one
+ * vector compare. If the changed pixels exceed the threshold, the scan
+ * stops and the frame is recounted with compute_histogram(). The first
+ * frame is always a full count.
+ *
+ * @param delta Engine handle
+ * @param frame New frame (width * height * channels bytes)
+ * @param histogram Output: histogram of the new frame
+ * @return Number of pixels that changed (all pixels on a recount), -1 on error
+ */
+int64_t histogram_delta_update(histogram_delta_t *delta, const uint8_t *frame,
+                               uint32_t histogram[256]);
+
+/**
+ * @brief Read the engine counters
+ */
+void histogram_delta_get_stats(const histogram_delta_t *delta, histogram_delta_stats_t *stats);
+
+/**
+ * @brief Free the engine and its previous-frame copy
+ */
+void histogram_delta_destroy(histogram_delta_t *delta);
+
+#endif // HISTOGRAM_DELTA_H
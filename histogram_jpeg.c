@@ -0,0 +1,149 @@
+#include "histogram_jpeg.h"
+#include "histogram_compute.h"
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+// jpeg_skip_scanlines() appeared in libjpeg-turbo 1.5
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+#define HISTOGRAM_JPEG_CAN_SKIP 1
+#endif
+
+// libjpeg error manager that returns to the caller instead of exit()ing
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf escape;
+} jpeg_error_t;
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    jpeg_error_t *err = (jpeg_error_t *)cinfo->err;
+
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->escape, 1);
+}
+
+/*
+ * Shared decode loop. approx == NULL is the exact path: full size, decoder
+ * default color output, every pixel counted.
+ */
+static int jpeg_count(const char *path, const histogram_jpeg_approx_t *approx,
+                      uint32_t histogram[256], histogram_jpeg_info_t *info)
+{
+    struct jpeg_decompress_struct cinfo;
+    jpeg_error_t jerr;
+    JSAMPARRAY row;
+    FILE *infile;
+    // Modified after setjmp(), so they must not live in registers
+    volatile uint64_t samples = 0;
+    volatile int stride = 1;
+
+    if (path == NULL || histogram == NULL) {
+        fprintf(stderr, "Invalid arguments\n");
+        return -1;
+    }
+
+    infile = fopen(path, "rb");
+    if (infile == NULL) {
+        perror("Failed to open JPEG");
+        return -1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_error_exit;
+    if (setjmp(jerr.escape)) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(infile);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, infile);
+    jpeg_read_header(&cinfo, TRUE);
+
+    if (approx != NULL) {
+        stride = approx->sample_stride > 1 ? approx->sample_stride : 1;
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = approx->scale_denom > 0 ? approx->scale_denom : 1;
+        cinfo.dct_method = JDCT_IFAST;
+        cinfo.do_fancy_upsampling = FALSE;
+        if (cinfo.jpeg_color_space == JCS_YCbCr || cinfo.jpeg_color_space == JCS_GRAYSCALE)
+            cinfo.out_color_space = JCS_GRAYSCALE;
+    }
+
+    jpeg_start_decompress(&cinfo);
+
+    // The only pixel storage: one scanline from the decoder's image pool
+    row = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+                                     cinfo.output_width * cinfo.output_components, 1);
+
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+    while (cinfo.output_scanline < cinfo.output_height) {
+        jpeg_read_scanlines(&cinfo, row, 1);
+        samples += histogram_accumulate_strided(row[0], cinfo.output_width,
+                                                cinfo.output_components, stride, histogram);
+
+        if (stride > 1 && cinfo.output_scanline < cinfo.output_height) {
+            JDIMENSION skip = cinfo.output_height - cinfo.output_scanline;
+            if (skip > (JDIMENSION)(stride - 1))
+                skip = stride - 1;
+#ifdef HISTOGRAM_JPEG_CAN_SKIP
+            jpeg_skip_scanlines(&cinfo, skip);
+#else
+            while (skip-- > 0)
+                jpeg_read_scanlines(&cinfo, row, 1);
+#endif
+        }
+    }
+
+    if (info != NULL) {
+        info->width = (int)cinfo.image_width;
+        info->height = (int)cinfo.image_height;
+        info->out_width = (int)cinfo.output_width;
+        info->out_height = (int)cinfo.output_height;
+        info->channels = cinfo.output_components;
+        info->samples = samples;
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(infile);
+
+    return 0;
+}
+
+int histogram_jpeg_stream(const char *path, uint32_t histogram[256],
+                          int *width, int *height, int *channels)
+{
+    histogram_jpeg_info_t info;
+
+    if (jpeg_count(path, NULL, histogram, &info) < 0)
+        return -1;
+
+    if (width != NULL)
+        *width = info.width;
+    if (height != NULL)
+        *height = info.height;
+    if (channels != NULL)
+        *channels = info.channels;
+
+    return 0;
+}
+
+int histogram_jpeg_approx(const char *path, const histogram_jpeg_approx_t *approx,
+                          uint32_t histogram[256], histogram_jpeg_info_t *info)
+{
+    static const histogram_jpeg_approx_t defaults = { 8, 1 };
+
+    if (approx == NULL)
+        approx = &defaults;
+
+    if (approx->scale_denom != 1 && approx->scale_denom != 2 &&
+        approx->scale_denom != 4 && approx->scale_denom != 8) {
+        fprintf(stderr, "Invalid JPEG scale 1/%d (must be 1, 2, 4 or 8)\n", approx->scale_denom);
+        return -1;
+    }
+
+    return jpeg_count(path, approx, histogram, info);
+}
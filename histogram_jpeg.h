@@ -0,0 +1,68 @@
+#ifndef HISTOGRAM_JPEG_H
+#define HISTOGRAM_JPEG_H
+
+#include <stdint.h>
+
+/**
+ * @brief Settings for an approximate (reduced) JPEG histogram
+ */
+typedef struct {
+    int scale_denom;    /**< libjpeg DCT scaling: decode at 1/1, 1/2, 1/4 or 1/8 size */
+    int sample_stride;  /**< Count every Nth pixel of every Nth row (1 = all) */
+} histogram_jpeg_approx_t;
+
+/**
+ * @brief Result details of a streamed JPEG histogram
+ */
+typedef struct {
+    int width;          /**< Full image width */
+    int height;         /**< Full image height */
+    int out_width;      /**< Decoded width (after DCT scaling) */
+    int out_height;     /**< Decoded height (after DCT scaling) */
+    int channels;       /**< Decoded channels */
+    uint64_t samples;   /**< Pixels actually counted */
+} histogram_jpeg_info_t;
+
+/**
+ * @brief Decode a JPEG and count it scanline by scanline
+ *
+ * Each scanline is converted and added to the histogram as soon as
+ * libjpeg decodes it, so the full image is never materialized: peak
+ * memory is a single row buffer (width * channels bytes) and every pixel
+ * is touched once while it is still in cache. Uses the same luminance
+ * rule as compute_histogram(). Progressive JPEGs still make libjpeg keep
+ * its own coefficient buffer for the whole image.
+ *
+ * @param path JPEG file path
+ * @param histogram Output histogram (overwritten)
+ * @param width Optional output for the image width (may be NULL)
+ * @param height Optional output for the image height (may be NULL)
+ * @param channels Optional output for decoded channels (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int histogram_jpeg_stream(const char *path, uint32_t histogram[256],
+                          int *width, int *height, int *channels);
+
+/**
+ * @brief Fast approximate histogram of a JPEG
+ *
+ * Decodes straight to grayscale (the JPEG luma plane, no color conversion
+ * or chroma upsampling) at a reduced size using libjpeg's DCT scaling,
+ * and optionally counts only every Nth pixel of every Nth row. Rows that
+ * aren't sampled are skipped inside libjpeg when it supports it.
+ *
+ * The result is meant for the display: its shape, not its absolute
+ * counts. Sampling error is bounded by histogram_sampling_bound(); the
+ * smoothing from DCT scaling is not statistical and has to be measured
+ * against the exact histogram (see histogram_distance()).
+ *
+ * @param path JPEG file path
+ * @param approx Scale and sampling settings (NULL = 1/8 scale, no sampling)
+ * @param histogram Output histogram (overwritten, holds samples not pixels)
+ * @param info Optional output with geometry and sample count (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int histogram_jpeg_approx(const char *path, const histogram_jpeg_approx_t *approx,
+                          uint32_t histogram[256], histogram_jpeg_info_t *info);
+
+#endif // HISTOGRAM_JPEG_H
@@ -1,91 +1,288 @@
+#define _POSIX_C_SOURCE 200809L
 #include "histogram_lib.h"
+#include "histogram_sim.h"
+#include "max7219_proto.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <math.h>
 
 #define DRIVER_PATH "/proc/max7219"
-#define BUFFER_SIZE 4096
 
-static int driver_fd = -1;
-static histogram_hw_config_t hw_config = {0};
+// Command prefix of a histogram frame
+#define HISTOGRAM_CMD "histogram "
+#define HISTOGRAM_CMD_LEN (sizeof(HISTOGRAM_CMD) - 1)
+#define BLIT_HEADER_LEN sizeof(struct max7219_blit_header)
 
-int histogram_init(void)
+// Each MAX7219 drives one 8x8 module
+#define MODULE_SIZE 8
+
+// Mailbox value: slot index plus a flag for a frame not yet taken
+#define MAILBOX_FRESH 4u
+#define MAILBOX_SLOT  3u
+
+/*
+ * Asynchronous display state. Frames go through a triple buffer: the
+ * producer fills its back slot and swaps it into the mailbox, the
+ * display thread swaps its front slot out of the mailbox. Neither side
+ * ever waits for the other; a frame still in the mailbox when the next
+ * one arrives is dropped.
+ */
+typedef struct {
+    pthread_t thread;
+    sem_t wake;                   // posted once per submission
+    uint8_t *slots[3];            // width bytes each
+    uint64_t slot_seq[3];         // submission number of each slot
+    atomic_uint mailbox;
+    unsigned back;                // producer-owned slot
+    unsigned front;               // display-thread-owned slot
+    uint64_t next_seq;            // producer-only
+    atomic_uint_fast64_t submitted;
+    atomic_uint_fast64_t displayed;
+    atomic_uint_fast64_t dropped;
+    atomic_uint_fast64_t flush_ns;   // moving average of one flush
+    atomic_bool stop;
+    atomic_bool failed;           // last flush failed
+    pthread_mutex_t lock;         // guards shown_seq, for flush waiters
+    pthread_cond_t done;
+    uint64_t shown_seq;
+} display_async_t;
+
+/*
+ * The driver's proc file, or the in-process simulator standing in for it
+ */
+typedef struct {
+    int fd;
+    histogram_sim_t *sim;
+} device_t;
+
+struct histogram_ctx {
+    device_t device;
+    histogram_hw_config_t config;
+    uint8_t *dimensioned;   // config.width bar heights
+    histogram_plan_t *plan; // 256 bins to the display, linear
+    bool blit;              // driver takes binary blits
+    histogram_canvas_t *bars;   // histogram frames, rendered here (blit only)
+    char *command;          // HISTOGRAM_CMD + config.width rotated bytes
+    bool histogram_shown;   // command holds what the display shows
+    size_t frame_bytes;     // driver framebuffer size, 8 bytes per matrix
+    uint8_t *shown;         // framebuffer on the display, if shown_valid
+    bool shown_valid;
+    uint8_t *update;        // MAX7219_OP_UPDATE(_WIDE) blit: header + index/value entries
+    display_async_t *async; // display thread, started by the first async call
+};
+
+struct histogram_canvas {
+    histogram_ctx_t *ctx;
+    int width;
+    int height;
+    size_t bytes;               // framebuffer bytes: one per module row
+    int stride;                 // framebuffer bytes per row of modules
+    uint16_t col_byte[256];     // logical column -> byte in the top module row
+    uint8_t row_mask[MODULE_SIZE];       // row y % 8 -> bit in that byte
+    uint8_t span_mask[MODULE_SIZE + 1];  // bottom n rows of a module column
+    uint8_t *command;           // MAX7219_OP_FRAME blit: header + framebuffer
+    uint8_t *framebuffer;       // points into command
+};
+
+// Context behind the original global API
+static histogram_ctx_t *default_ctx = NULL;
+static histogram_hw_config_t probed_config = {0};
+static bool probed_config_valid = false;
+
+/*
+ * Process-wide instrumentation. Every counter is a relaxed atomic
+ * updated in place, so recording costs two clock reads and a few
+ * uncontended increments and never takes a lock.
+ */
+typedef struct {
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t total_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[HISTOGRAM_LATENCY_BUCKETS];
+} op_counters_t;
+
+static struct {
+    op_counters_t ops[HISTOGRAM_OP_COUNT];
+    atomic_uint_fast64_t frames;
+    atomic_uint_fast64_t unchanged;
+    atomic_uint_fast64_t start_ns;        // first frame since the last reset
+    atomic_uint_fast64_t dump_interval_ns;
+    atomic_uint_fast64_t next_dump_ns;
+    atomic_uint_fast64_t dump_ns;         // time of the previous dump
+    atomic_uint_fast64_t dump_frames;     // frames at the previous dump
+    atomic_bool dump_configured;
+} stats;
+
+static const char *const op_names[HISTOGRAM_OP_COUNT] = {
+    "display", "clear", "pixel", "brightness", "dimension"
+};
+
+static uint64_t monotonic_ns(void)
 {
-    driver_fd = open(DRIVER_PATH, O_RDWR);
-    if (driver_fd < 0) {
-        perror("Failed to open MAX7219 driver");
-        return -1;
-    }
+    struct timespec ts;
     
-    // Read hardware configuration
-    if (histogram_get_hw_config(&hw_config) < 0) {
-        close(driver_fd);
-        driver_fd = -1;
-        return -1;
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Bucket b holds latencies in [2^(b-1), 2^b) ns; bucket 0 holds 0
+static inline int latency_bucket(uint64_t ns)
+{
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
     
-    printf("Hardware detected: %d matrices, %dx%d resolution\n",
-           hw_config.matrices, hw_config.width, hw_config.height);
+    return bucket < HISTOGRAM_LATENCY_BUCKETS ? bucket : HISTOGRAM_LATENCY_BUCKETS - 1;
+}
+
+static void stats_record(histogram_op_t op, uint64_t start_ns, ssize_t bytes)
+{
+    op_counters_t *counters = &stats.ops[op];
+    uint64_t ns = monotonic_ns() - start_ns;
+    uint64_t max = atomic_load_explicit(&counters->max_ns, memory_order_relaxed);
     
-    // Clear display on init
-    histogram_clear();
+    atomic_fetch_add_explicit(&counters->calls, 1, memory_order_relaxed);
+    if (bytes < 0)
+        atomic_fetch_add_explicit(&counters->errors, 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&counters->bytes, (uint64_t)bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->buckets[latency_bucket(ns)], 1, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&counters->max_ns, &max, ns,
+                                                              memory_order_relaxed,
+                                                              memory_order_relaxed))
+        ;
+}
+
+static void stats_dump_configure(void)
+{
+    const char *env;
+    double seconds;
     
-    return 0;
+    if (atomic_load_explicit(&stats.dump_configured, memory_order_relaxed) ||
+        atomic_exchange(&stats.dump_configured, true))
+        return;
+    env = getenv(HISTOGRAM_STATS_ENV);
+    if (env != NULL && (seconds = atof(env)) > 0)
+        histogram_set_stats_interval(seconds);
 }
 
-void histogram_cleanup(void)
+// Count a frame that reached (or already was on) the display
+static void stats_frame(bool changed)
 {
-    if (driver_fd >= 0) {
-        histogram_clear();
-        close(driver_fd);
-        driver_fd = -1;
+    uint64_t now = 0, start, next, interval, elapsed, frames;
+    histogram_stats_t snapshot;
+    
+    atomic_fetch_add_explicit(&stats.frames, 1, memory_order_relaxed);
+    if (!changed)
+        atomic_fetch_add_explicit(&stats.unchanged, 1, memory_order_relaxed);
+    
+    start = atomic_load_explicit(&stats.start_ns, memory_order_relaxed);
+    if (start == 0) {
+        now = monotonic_ns();
+        atomic_compare_exchange_strong(&stats.start_ns, &start, now);
     }
+    
+    // Periodic dump: whoever moves next_dump_ns forward prints
+    stats_dump_configure();
+    interval = atomic_load_explicit(&stats.dump_interval_ns, memory_order_relaxed);
+    if (interval == 0)
+        return;
+    if (now == 0)
+        now = monotonic_ns();
+    next = atomic_load_explicit(&stats.next_dump_ns, memory_order_relaxed);
+    if (now < next || !atomic_compare_exchange_strong(&stats.next_dump_ns, &next, now + interval))
+        return;
+    
+    histogram_get_stats(&snapshot);
+    elapsed = now - atomic_exchange(&stats.dump_ns, now);
+    frames = snapshot.frames - atomic_exchange(&stats.dump_frames, snapshot.frames);
+    if (next == 0)
+        return;     // the first frame only arms the timer
+    
+    fprintf(stderr, "Display stats: %.1f fps over the last %.1f s\n",
+            frames * 1e9 / (double)elapsed, elapsed / 1e9);
+    histogram_print_stats(stderr, &snapshot);
 }
 
-int histogram_get_hw_config(histogram_hw_config_t *config)
+// Open the device named by path, HISTOGRAM_DEVICE or the default
+static int device_open(const char *path, device_t *device)
 {
-    char buffer[256];
-    ssize_t bytes_read;
-    int fd;
+    if (path == NULL)
+        path = getenv(HISTOGRAM_DEVICE_ENV);
+    if (path == NULL || *path == '\0')
+        path = DRIVER_PATH;
     
-    if (config == NULL) {
-        fprintf(stderr, "Invalid config pointer\n");
-        return -1;
+    device->fd = -1;
+    device->sim = NULL;
+    
+    if (histogram_sim_is_device(path)) {
+        device->sim = histogram_sim_create(path);
+        return device->sim != NULL ? 0 : -1;
     }
     
-    // Open driver for reading configuration
-    // Note: we open a new fd here because /proc files don't support lseek
-    fd = open(DRIVER_PATH, O_RDONLY);
-    if (fd < 0) {
-        perror("Failed to open driver for reading config");
+    device->fd = open(path, O_RDWR);
+    if (device->fd < 0) {
+        perror("Failed to open MAX7219 driver");
         return -1;
     }
+    return 0;
+}
+
+static void device_close(device_t *device)
+{
+    if (device->sim != NULL)
+        histogram_sim_destroy(device->sim);
+    else if (device->fd >= 0)
+        close(device->fd);
+    device->fd = -1;
+    device->sim = NULL;
+}
+
+static inline bool device_is_open(const device_t *device)
+{
+    return device->fd >= 0 || device->sim != NULL;
+}
+
+static ssize_t device_write(device_t *device, const void *buf, size_t size)
+{
+    if (device->sim != NULL)
+        return histogram_sim_write(device->sim, buf, size);
+    return write(device->fd, buf, size);
+}
+
+static ssize_t device_pread(device_t *device, void *buf, size_t count, off_t offset)
+{
+    if (device->sim != NULL)
+        return histogram_sim_pread(device->sim, buf, count, offset);
+    return pread(device->fd, buf, count, offset);
+}
+
+// Parse the text reply of drivers without the binary query
+static int parse_text_config(device_t *device, histogram_hw_config_t *config)
+{
+    char buffer[256];
+    ssize_t bytes_read;
     
-    // Read from driver
     memset(buffer, 0, sizeof(buffer));
-    bytes_read = read(fd, buffer, sizeof(buffer) - 1);
-    
-    // Close this temporary fd
-    close(fd);
-    
+    bytes_read = device_pread(device, buffer, sizeof(buffer) - 1, 0);
     if (bytes_read < 0) {
         perror("Failed to read hardware config");
         return -1;
     }
-    
     if (bytes_read == 0) {
         fprintf(stderr, "No data read from driver\n");
         return -1;
     }
     
-    buffer[bytes_read] = '\0';
-    
-    // Debug: print what we read
-    printf("Read from driver (%zd bytes): %s", bytes_read, buffer);
-    
     // Parse configuration: "matrices=4\nwidth=32\nheight=8\n"
     if (sscanf(buffer, "matrices=%d\nwidth=%d\nheight=%d",
                &config->matrices, &config->width, &config->height) != 3) {
@@ -97,74 +294,413 @@ int histogram_get_hw_config(histogram_hw_config_t *config)
     return 0;
 }
 
+// Ask the driver for its geometry on an open read/write descriptor:
+// one write and one pread when the driver speaks the binary query.
+// version is 0 for drivers that only answer in text.
+static int query_hw_config(device_t *device, histogram_hw_config_t *config, int *version)
+{
+    struct max7219_info info;
+    ssize_t bytes_read;
+    
+    if (device_write(device, MAX7219_CMD_QUERY, strlen(MAX7219_CMD_QUERY)) < 0) {
+        perror("Failed to query hardware config");
+        return -1;
+    }
+    
+    memset(&info, 0, sizeof(info));
+    bytes_read = device_pread(device, &info, sizeof(info), 0);
+    if (bytes_read < (ssize_t)sizeof(info) || info.magic != MAX7219_INFO_MAGIC) {
+        if (version != NULL)
+            *version = 0;
+        return parse_text_config(device, config);
+    }
+    
+    if (version != NULL)
+        *version = info.version;
+    config->matrices = info.matrices;
+    config->width = info.width;
+    config->height = info.height;
+    return 0;
+}
+
+// Fixed-point one: input bin weights are Q16 and always sum to this
+#define PLAN_ONE      65536u
+// Max-normalized column values are Q32 fractions of the tallest column
+#define PLAN_RATIO_ONE (1ull << 32)
+// Column sums are reduced to 16 significant bits before normalizing
+#define PLAN_NORM_BITS 16
+
+struct histogram_plan {
+    int input_bins;
+    int width;
+    int height;
+    histogram_scale_t scale;
+    uint16_t first[256];        // whole input bins of column c: [first, last)
+    uint16_t last[256];
+    uint16_t head_bin[256];     // bin split with the previous column
+    uint16_t tail_bin[256];     // bin split with the next column
+    uint32_t head_weight[256];  // Q16 shares of those bins, 0 if none
+    uint32_t tail_weight[256];
+    uint64_t threshold[255];    // Q32 ratio needed for height k + 1
+};
+
+static int plan_build(struct histogram_plan *plan, int input_bins, int width, int height,
+                      histogram_scale_t scale)
+{
+    int i, k, col;
+    
+    if (input_bins <= 0 || input_bins > 256 || width <= 0 || width > input_bins ||
+        height <= 0 || height > 255) {
+        fprintf(stderr, "Invalid dimensioning plan: %d bins to %dx%d\n",
+                input_bins, width, height);
+        return -1;
+    }
+    if (scale != HISTOGRAM_SCALE_LINEAR && scale != HISTOGRAM_SCALE_SQRT &&
+        scale != HISTOGRAM_SCALE_LOG) {
+        fprintf(stderr, "Invalid scale mode: %d\n", (int)scale);
+        return -1;
+    }
+    
+    memset(plan, 0, sizeof(*plan));
+    plan->input_bins = input_bins;
+    plan->width = width;
+    plan->height = height;
+    plan->scale = scale;
+    
+    // Column c covers input range [c * bins / width, (c + 1) * bins / width).
+    // With width <= bins an input bin straddles at most one boundary, so
+    // a column has whole bins plus at most one split bin on each side.
+    for (col = 0; col < width; col++) {
+        plan->first[col] = (uint16_t)input_bins;
+        plan->last[col] = 0;
+    }
+    for (i = 0; i < input_bins; i++) {
+        int64_t room;   // part of bin i left in its column, in 1/width bins
+        
+        col = (int)((int64_t)i * width / input_bins);
+        room = (int64_t)(col + 1) * input_bins - (int64_t)i * width;
+        
+        if (room >= width) {
+            if (i < plan->first[col])
+                plan->first[col] = (uint16_t)i;
+            plan->last[col] = (uint16_t)(i + 1);
+        } else {
+            plan->tail_bin[col] = (uint16_t)i;
+            plan->tail_weight[col] = (uint32_t)(room * PLAN_ONE / width);
+            plan->head_bin[col + 1] = (uint16_t)i;
+            plan->head_weight[col + 1] = PLAN_ONE - plan->tail_weight[col];
+        }
+    }
+    for (col = 0; col < width; col++) {
+        if (plan->last[col] == 0)
+            plan->first[col] = 0;
+    }
+    
+    // Height k + 1 is reached once the column's share of the tallest
+    // column reaches threshold[k]
+    for (k = 0; k < height; k++) {
+        double level = (double)(k + 1) / height;
+        double ratio;
+        
+        switch (scale) {
+        case HISTOGRAM_SCALE_SQRT:
+            ratio = level * level;
+            break;
+        case HISTOGRAM_SCALE_LOG:
+            ratio = pow(10.0, HISTOGRAM_LOG_DECADES * (level - 1.0));
+            break;
+        default:
+            ratio = level;
+            break;
+        }
+        plan->threshold[k] = k + 1 == height ? PLAN_RATIO_ONE :
+                             (uint64_t)ceil(ratio * (double)PLAN_RATIO_ONE);
+    }
+    
+    return 0;
+}
+
+static void plan_apply(const struct histogram_plan *plan, const uint32_t *input, uint8_t *output)
+{
+    uint64_t grouped[256];
+    uint64_t max_value = 0, reciprocal, ratio, sum;
+    int i, col, k, shift = 0;
+    unsigned level;
+    
+    // Whole bins are summed in a register, split bins add their Q16
+    // share; columns without a split bin have zero weights
+    for (col = 0; col < plan->width; col++) {
+        sum = 0;
+        for (i = plan->first[col]; i < plan->last[col]; i++)
+            sum += input[i];
+        grouped[col] = sum * PLAN_ONE +
+                       (uint64_t)input[plan->head_bin[col]] * plan->head_weight[col] +
+                       (uint64_t)input[plan->tail_bin[col]] * plan->tail_weight[col];
+        max_value = grouped[col] > max_value ? grouped[col] : max_value;
+    }
+    
+    // Normalize with one reciprocal: keep 16 significant bits of the max
+    // so column * reciprocal fits in 64 bits. Rounding the reciprocal up
+    // keeps the tallest column at exactly PLAN_RATIO_ONE or above.
+    if (max_value >= (1ull << PLAN_NORM_BITS))
+        shift = 64 - __builtin_clzll(max_value) - PLAN_NORM_BITS;
+    max_value >>= shift;
+    reciprocal = max_value == 0 ? 0 :
+                 ((1ull << (32 + PLAN_NORM_BITS)) + max_value - 1) / max_value;
+    
+    for (col = 0; col < plan->width; col++) {
+        ratio = ((grouped[col] >> shift) * reciprocal) >> PLAN_NORM_BITS;
+        level = 0;
+        for (k = 0; k < plan->height; k++)
+            level += ratio >= plan->threshold[k];
+        output[col] = (uint8_t)level;
+    }
+}
+
+histogram_plan_t *histogram_plan_create(int input_bins, int width, int height,
+                                        histogram_scale_t scale)
+{
+    histogram_plan_t *plan;
+    
+    plan = malloc(sizeof(*plan));
+    if (plan == NULL) {
+        perror("Failed to allocate dimensioning plan");
+        return NULL;
+    }
+    
+    if (plan_build(plan, input_bins, width, height, scale) < 0) {
+        free(plan);
+        return NULL;
+    }
+    
+    return plan;
+}
+
+int histogram_plan_apply(const histogram_plan_t *plan, const uint32_t *input_histogram,
+                         uint8_t *output_histogram)
+{
+    uint64_t start;
+    
+    if (plan == NULL || input_histogram == NULL || output_histogram == NULL) {
+        fprintf(stderr, "Invalid histogram pointers\n");
+        return -1;
+    }
+    
+    start = monotonic_ns();
+    plan_apply(plan, input_histogram, output_histogram);
+    stats_record(HISTOGRAM_OP_DIMENSION, start, 0);
+    return 0;
+}
+
+void histogram_plan_destroy(histogram_plan_t *plan)
+{
+    free(plan);
+}
+
 int histogram_dimension(const uint32_t input_histogram[256], 
                        uint8_t *output_histogram,
                        int hw_width,
                        int hw_height)
 {
-    int i, col;
-    uint32_t max_value = 0;
-    uint32_t *grouped;
-    int bucket_size;
+    struct histogram_plan plan;
+    uint64_t start = monotonic_ns();
     
     if (input_histogram == NULL || output_histogram == NULL) {
         fprintf(stderr, "Invalid histogram pointers\n");
         return -1;
     }
     
-    if (hw_width <= 0 || hw_width > 256 || hw_height <= 0) {
-        fprintf(stderr, "Invalid hardware dimensions: %dx%d\n", hw_width, hw_height);
+    // One-shot plan on the stack; callers dimensioning every frame
+    // should keep a histogram_plan_t instead
+    if (plan_build(&plan, 256, hw_width, hw_height, HISTOGRAM_SCALE_LINEAR) < 0)
+        return -1;
+    
+    plan_apply(&plan, input_histogram, output_histogram);
+    stats_record(HISTOGRAM_OP_DIMENSION, start, 0);
+    return 0;
+}
+
+/*
+ * Display layout. The modules form a wall of width / 8 modules per row,
+ * filled row by row in chain order (see struct max7219_info), so pixel
+ * (x, y) lies in module (y / 8) * (width / 8) + x / 8. The library
+ * applies the 90° rotation (new_x = old_y, new_y = size - 1 - old_x) to
+ * every 8x8 module: logical column x is row 7 - x % 8 of its module and
+ * logical row y is bit 7 - y % 8 of that row's byte (the MSB is the
+ * leftmost LED). Eight rows of a column are therefore one framebuffer
+ * byte, in the driver's framebuffer[matrix][row] order.
+ */
+static inline int layout_byte(int x, int y, int width)
+{
+    return (y / MODULE_SIZE) * width + (x / MODULE_SIZE) * MODULE_SIZE +
+           (MODULE_SIZE - 1 - x % MODULE_SIZE);
+}
+
+static inline uint8_t layout_mask(int y)
+{
+    return (uint8_t)(0x80 >> (y % MODULE_SIZE));
+}
+
+// The modules tile the display exactly, as the layout above needs
+static bool layout_is_wall(const histogram_hw_config_t *config)
+{
+    return config->width % MODULE_SIZE == 0 && config->height % MODULE_SIZE == 0 &&
+           (config->width / MODULE_SIZE) * (config->height / MODULE_SIZE) == config->matrices;
+}
+
+static void async_stop(histogram_ctx_t *ctx);
+
+// Fill in a blit header; the payload follows it in the same buffer
+static void blit_header(uint8_t *buffer, const histogram_ctx_t *ctx, uint8_t opcode,
+                        size_t length)
+{
+    struct max7219_blit_header header = {
+        .magic = MAX7219_BLIT_MAGIC,
+        .opcode = opcode,
+        .matrices = (uint8_t)ctx->config.matrices,
+        .rows = MODULE_SIZE,
+        .flags = 0,
+        .length = (uint16_t)length,
+    };
+    
+    memcpy(buffer, &header, sizeof(header));
+}
+
+// One write() to the device, timed and counted as op
+static ssize_t timed_write(histogram_ctx_t *ctx, histogram_op_t op, const void *buf,
+                           size_t size)
+{
+    uint64_t start = monotonic_ns();
+    ssize_t written = device_write(&ctx->device, buf, size);
+    
+    stats_record(op, start, written);
+    return written;
+}
+
+// Send one display command with a single write()
+static int send_command(histogram_ctx_t *ctx, const void *command, size_t total_size,
+                        const char *what)
+{
+    ssize_t written = timed_write(ctx, HISTOGRAM_OP_DISPLAY, command, total_size);
+    
+    if (written < 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", what, strerror(errno));
         return -1;
     }
     
-    // Allocate temporary grouped array
-    grouped = calloc(hw_width, sizeof(uint32_t));
-    if (grouped == NULL) {
-        perror("Failed to allocate memory");
+    if ((size_t)written != total_size) {
+        fprintf(stderr, "Incomplete write: %zd of %zu bytes\n", written, total_size);
         return -1;
     }
     
-    // Calculate bucket size (how many intensities per column)
-    bucket_size = 256 / hw_width;
-    if (bucket_size == 0) bucket_size = 1;
+    return 0;
+}
+
+histogram_ctx_t *histogram_ctx_open(const char *path)
+{
+    histogram_ctx_t *ctx;
+    int version;
+    
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        perror("Failed to allocate context");
+        return NULL;
+    }
+    
+    if (device_open(path, &ctx->device) < 0) {
+        free(ctx);
+        return NULL;
+    }
     
-    // Group intensities into buckets
-    for (i = 0; i < 256; i++) {
-        col = i / bucket_size;
-        if (col >= hw_width) col = hw_width - 1;
-        grouped[col] += input_histogram[i];
+    // Negotiate geometry once; every buffer is sized from it
+    if (query_hw_config(&ctx->device, &ctx->config, &version) < 0) {
+        histogram_ctx_close(ctx);
+        return NULL;
+    }
+    if (ctx->config.width <= 0 || ctx->config.width > 256 || ctx->config.height <= 0) {
+        fprintf(stderr, "Invalid hardware dimensions: %dx%d\n",
+                ctx->config.width, ctx->config.height);
+        histogram_ctx_close(ctx);
+        return NULL;
     }
     
-    // Find maximum value for scaling
-    for (col = 0; col < hw_width; col++) {
-        if (grouped[col] > max_value)
-            max_value = grouped[col];
+    ctx->blit = version >= MAX7219_INFO_VERSION_BLIT;
+    ctx->frame_bytes = (size_t)ctx->config.matrices * MODULE_SIZE;
+    ctx->dimensioned = malloc(ctx->config.width);
+    // Bar heights are bytes: walls over 255 rows get bars up to 255
+    ctx->plan = histogram_plan_create(256, ctx->config.width,
+                                      ctx->config.height < 255 ? ctx->config.height : 255,
+                                      HISTOGRAM_SCALE_LINEAR);
+    ctx->command = malloc(HISTOGRAM_CMD_LEN + ctx->config.width);
+    ctx->shown = malloc(ctx->frame_bytes);
+    ctx->update = malloc(BLIT_HEADER_LEN + 3 * ctx->frame_bytes);
+    if (ctx->dimensioned == NULL || ctx->plan == NULL || ctx->command == NULL ||
+        ctx->shown == NULL || ctx->update == NULL) {
+        perror("Failed to allocate display buffers");
+        histogram_ctx_close(ctx);
+        return NULL;
     }
+    memcpy(ctx->command, HISTOGRAM_CMD, HISTOGRAM_CMD_LEN);
     
-    // Scale to hardware height
-    for (col = 0; col < hw_width; col++) {
-        if (max_value == 0) {
-            output_histogram[col] = 0;
-        } else {
-            uint32_t scaled = (grouped[col] * (uint32_t)hw_height) / max_value;
-            if (scaled > (uint32_t)hw_height) scaled = (uint32_t)hw_height;
-            output_histogram[col] = (uint8_t)scaled;
+    // Blit-capable drivers get histograms as ready-made framebuffers
+    if (ctx->blit && layout_is_wall(&ctx->config)) {
+        ctx->bars = canvas_create(ctx);
+        if (ctx->bars == NULL) {
+            histogram_ctx_close(ctx);
+            return NULL;
         }
     }
     
-    free(grouped);
+    // Clear display on open
+    histogram_ctx_clear(ctx);
+    
+    return ctx;
+}
+
+void histogram_ctx_close(histogram_ctx_t *ctx)
+{
+    if (ctx == NULL)
+        return;
+    
+    async_stop(ctx);
+    
+    if (device_is_open(&ctx->device)) {
+        if (ctx->command != NULL)
+            histogram_ctx_clear(ctx);
+        device_close(&ctx->device);
+    }
+    free(ctx->dimensioned);
+    histogram_plan_destroy(ctx->plan);
+    free(ctx->command);
+    free(ctx->shown);
+    free(ctx->update);
+    canvas_destroy(ctx->bars);
+    free(ctx);
+}
+
+histogram_sim_t *histogram_ctx_sim(const histogram_ctx_t *ctx)
+{
+    return ctx != NULL ? ctx->device.sim : NULL;
+}
+
+int histogram_ctx_get_hw_config(const histogram_ctx_t *ctx, histogram_hw_config_t *config)
+{
+    if (ctx == NULL || config == NULL) {
+        fprintf(stderr, "Invalid config pointer\n");
+        return -1;
+    }
+    
+    *config = ctx->config;
     return 0;
 }
 
-int histogram_display(const uint8_t *histogram, int width)
+int histogram_ctx_display(histogram_ctx_t *ctx, const uint8_t *histogram, int width)
 {
-    char buffer[BUFFER_SIZE];
-    ssize_t written;
-    size_t total_size;
-    uint8_t *rotated;
+    bool changed;
+    char *rotated;
     int i;
     
-    if (driver_fd < 0) {
+    if (ctx == NULL) {
         fprintf(stderr, "Driver not initialized\n");
         return -1;
     }
@@ -175,21 +711,19 @@ int histogram_display(const uint8_t *histogram, int width)
     }
     
     // Verify width matches hardware
-    if (width != hw_config.width) {
+    if (width != ctx->config.width) {
         fprintf(stderr, "Histogram width (%d) doesn't match hardware width (%d)\n",
-                width, hw_config.width);
+                width, ctx->config.width);
         return -1;
     }
     
-    // Allocate buffer for rotated histogram
-    // After 90° CW rotation, the display shows the histogram rotated
-    // Width becomes height, so we need width entries still
-    rotated = malloc(width * sizeof(uint8_t));
-    if (rotated == NULL) {
-        perror("Failed to allocate memory for rotation");
-        return -1;
+    // Render the bars here and send the framebuffer rows that changed
+    if (ctx->bars != NULL) {
+        canvas_bars(ctx->bars, histogram, width);
+        return canvas_commit(ctx->bars);
     }
     
+    // Older drivers take the text command and draw the bars themselves.
     // Rotate 90 degrees clockwise
     // Original histogram: histogram[0..31] with heights 0..8
     // Displayed as vertical bars from bottom to top
@@ -201,40 +735,39 @@ int histogram_display(const uint8_t *histogram, int width)
     //
     // So: rotated[i] = histogram[width - 1 - i]
     // This reverses the order (rightmost becomes bottom)
-    
+    //
+    // The rotated bytes are written straight after the preformatted
+    // "histogram " prefix of the context's command buffer, which still
+    // holds the previous frame: an unchanged histogram isn't resent.
+    rotated = ctx->command + HISTOGRAM_CMD_LEN;
+    changed = !ctx->histogram_shown;
     for (i = 0; i < width; i++) {
-        rotated[i] = histogram[width - 1 - i];
+        if (rotated[i] != (char)histogram[width - 1 - i]) {
+            rotated[i] = histogram[width - 1 - i];
+            changed = true;
+        }
     }
     
-    // Prepare command: "histogram " followed by width bytes
-    strcpy(buffer, "histogram ");
-    memcpy(buffer + strlen(buffer), rotated, width);
-    
-    total_size = strlen("histogram ") + width;
-    
-    written = write(driver_fd, buffer, total_size);
-    
-    free(rotated);
-    
-    if (written < 0) {
-        perror("Failed to write histogram data");
-        return -1;
+    if (!changed) {
+        stats_frame(false);
+        return 0;
     }
     
-    if ((size_t)written != total_size) {
-        fprintf(stderr, "Incomplete write: %zd of %zu bytes\n", written, total_size);
+    // The driver only reclocks the rows this frame changes
+    ctx->shown_valid = false;
+    ctx->histogram_shown = send_command(ctx, ctx->command, HISTOGRAM_CMD_LEN + width,
+                                        "histogram data") == 0;
+    if (!ctx->histogram_shown)
         return -1;
-    }
-    
+    stats_frame(true);
     return 0;
 }
 
-int histogram_display_auto(const uint32_t histogram[256])
+int histogram_ctx_display_auto(histogram_ctx_t *ctx, const uint32_t histogram[256])
 {
-    uint8_t *dimensioned;
-    int result;
+    uint64_t start;
     
-    if (driver_fd < 0) {
+    if (ctx == NULL) {
         fprintf(stderr, "Driver not initialized\n");
         return -1;
     }
@@ -244,87 +777,85 @@ int histogram_display_auto(const uint32_t histogram[256])
         return -1;
     }
     
-    // Allocate space for dimensioned histogram
-    dimensioned = malloc(hw_config.width * sizeof(uint8_t));
-    if (dimensioned == NULL) {
-        perror("Failed to allocate memory");
-        return -1;
-    }
-    
-    // Dimension the histogram
-    result = histogram_dimension(histogram, dimensioned, 
-                                 hw_config.width, hw_config.height);
-    if (result < 0) {
-        free(dimensioned);
-        return -1;
-    }
-    
-    // Display it
-    result = histogram_display(dimensioned, hw_config.width);
+    // Dimension with the context's plan into its scratch, then display it
+    start = monotonic_ns();
+    plan_apply(ctx->plan, histogram, ctx->dimensioned);
+    stats_record(HISTOGRAM_OP_DIMENSION, start, 0);
     
-    free(dimensioned);
-    return result;
+    return histogram_ctx_display(ctx, ctx->dimensioned, ctx->config.width);
 }
 
-int matrix_set_pixel(int x, int y, bool on)
+int histogram_ctx_set_pixel(histogram_ctx_t *ctx, int x, int y, bool on)
 {
     char buffer[64];
     ssize_t written;
     int rotated_x, rotated_y;
     
-    if (driver_fd < 0) {
+    if (ctx == NULL) {
         fprintf(stderr, "Driver not initialized\n");
         return -1;
     }
     
-    if (x < 0 || x >= hw_config.width || y < 0 || y >= hw_config.height) {
+    if (x < 0 || x >= ctx->config.width || y < 0 || y >= ctx->config.height ||
+        !layout_is_wall(&ctx->config)) {
         fprintf(stderr, "Invalid pixel coordinates: (%d, %d)\n", x, y);
         return -1;
     }
     
-    // Rotate 90 degrees clockwise
-    // Formula for 90° CW rotation:
-    // new_x = old_y
-    // new_y = (width - 1) - old_x
-    rotated_x = y;
-    rotated_y = (hw_config.width - 1) - x;
+    // Same module and rotation as the canvas, in the driver's chain
+    // coordinates: 8 columns per module, one row of modules
+    rotated_x = (layout_byte(x, y, ctx->config.width) / MODULE_SIZE) * MODULE_SIZE +
+                y % MODULE_SIZE;
+    rotated_y = MODULE_SIZE - 1 - x % MODULE_SIZE;
     
     snprintf(buffer, sizeof(buffer), "pixel %d %d %d", rotated_x, rotated_y, on ? 1 : 0);
     
-    written = write(driver_fd, buffer, strlen(buffer));
+    written = timed_write(ctx, HISTOGRAM_OP_PIXEL, buffer, strlen(buffer));
     if (written < 0) {
         perror("Failed to set pixel");
+        ctx->shown_valid = false;
         return -1;
     }
     
+    if (on)
+        ctx->shown[layout_byte(x, y, ctx->config.width)] |= layout_mask(y);
+    else
+        ctx->shown[layout_byte(x, y, ctx->config.width)] &= (uint8_t)~layout_mask(y);
+    ctx->histogram_shown = false;
+    
     return 0;
 }
 
-int histogram_clear(void)
+int histogram_ctx_clear(histogram_ctx_t *ctx)
 {
     const char *cmd = "clear";
     ssize_t written;
     
-    if (driver_fd < 0) {
+    if (ctx == NULL) {
         fprintf(stderr, "Driver not initialized\n");
         return -1;
     }
     
-    written = write(driver_fd, cmd, strlen(cmd));
+    written = timed_write(ctx, HISTOGRAM_OP_CLEAR, cmd, strlen(cmd));
     if (written < 0) {
         perror("Failed to clear display");
+        ctx->shown_valid = false;
         return -1;
     }
     
+    memset(ctx->shown, 0, ctx->frame_bytes);
+    ctx->shown_valid = true;
+    ctx->histogram_shown = false;
+    
     return 0;
 }
 
-int histogram_set_brightness(int level)
+int histogram_ctx_set_brightness(histogram_ctx_t *ctx, int level)
 {
     char buffer[32];
     ssize_t written;
     
-    if (driver_fd < 0) {
+    if (ctx == NULL) {
         fprintf(stderr, "Driver not initialized\n");
         return -1;
     }
@@ -336,11 +867,639 @@ int histogram_set_brightness(int level)
     
     snprintf(buffer, sizeof(buffer), "intensity %d", level);
     
-    written = write(driver_fd, buffer, strlen(buffer));
+    written = timed_write(ctx, HISTOGRAM_OP_BRIGHTNESS, buffer, strlen(buffer));
     if (written < 0) {
         perror("Failed to set brightness");
         return -1;
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+histogram_canvas_t *canvas_create(histogram_ctx_t *ctx)
+{
+    histogram_canvas_t *canvas;
+    int x, y;
+    
+    if (ctx == NULL)
+        ctx = default_ctx;
+    if (ctx == NULL) {
+        fprintf(stderr, "Driver not initialized\n");
+        return NULL;
+    }
+    if (!ctx->blit) {
+        fprintf(stderr, "Driver doesn't support framebuffer blits\n");
+        return NULL;
+    }
+    if (!layout_is_wall(&ctx->config)) {
+        fprintf(stderr, "Unsupported canvas geometry: %dx%d with %d matrices\n",
+                ctx->config.width, ctx->config.height, ctx->config.matrices);
+        return NULL;
+    }
+    
+    canvas = calloc(1, sizeof(*canvas));
+    if (canvas == NULL) {
+        perror("Failed to allocate canvas");
+        return NULL;
+    }
+    canvas->ctx = ctx;
+    canvas->width = ctx->config.width;
+    canvas->height = ctx->config.height;
+    canvas->bytes = (size_t)canvas->width * canvas->height / 8;
+    canvas->stride = canvas->width;
+    
+    canvas->command = calloc(1, BLIT_HEADER_LEN + canvas->bytes);
+    if (canvas->command == NULL) {
+        perror("Failed to allocate canvas");
+        free(canvas);
+        return NULL;
+    }
+    blit_header(canvas->command, ctx, MAX7219_OP_FRAME, canvas->bytes);
+    canvas->framebuffer = canvas->command + BLIT_HEADER_LEN;
+    
+    // Precompute the rotation once; drawing is then table lookups
+    for (x = 0; x < canvas->width; x++)
+        canvas->col_byte[x] = (uint16_t)layout_byte(x, 0, canvas->width);
+    for (y = 0; y < MODULE_SIZE; y++)
+        canvas->row_mask[y] = layout_mask(y);
+    for (y = 1; y <= MODULE_SIZE; y++)
+        canvas->span_mask[y] = canvas->span_mask[y - 1] | canvas->row_mask[MODULE_SIZE - y];
+    
+    return canvas;
+}
+
+void canvas_destroy(histogram_canvas_t *canvas)
+{
+    if (canvas == NULL)
+        return;
+    free(canvas->command);
+    free(canvas);
+}
+
+void canvas_clear(histogram_canvas_t *canvas)
+{
+    memset(canvas->framebuffer, 0, canvas->bytes);
+}
+
+// Set or clear the rows selected by mask of one column in the module
+// row holding row y
+static inline void column_apply(histogram_canvas_t *canvas, int x, int y, uint8_t mask,
+                                bool on)
+{
+    uint8_t *byte = &canvas->framebuffer[canvas->col_byte[x] +
+                                         (y / MODULE_SIZE) * canvas->stride];
+    
+    if (on)
+        *byte |= mask;
+    else
+        *byte &= (uint8_t)~mask;
+}
+
+// Mask of rows [y, end) within one module row
+static inline uint8_t rows_mask(const histogram_canvas_t *canvas, int y, int end)
+{
+    uint8_t mask = 0;
+    
+    for (; y < end; y++)
+        mask |= canvas->row_mask[y % MODULE_SIZE];
+    return mask;
+}
+
+void canvas_pixel(histogram_canvas_t *canvas, int x, int y, bool on)
+{
+    if (x < 0 || x >= canvas->width || y < 0 || y >= canvas->height)
+        return;
+    column_apply(canvas, x, y, canvas->row_mask[y % MODULE_SIZE], on);
+}
+
+void canvas_hline(histogram_canvas_t *canvas, int x, int y, int len, bool on)
+{
+    canvas_rect(canvas, x, y, len, 1, on);
+}
+
+void canvas_vline(histogram_canvas_t *canvas, int x, int y, int len, bool on)
+{
+    canvas_rect(canvas, x, y, 1, len, on);
+}
+
+void canvas_rect(histogram_canvas_t *canvas, int x, int y, int w, int h, bool on)
+{
+    uint8_t mask;
+    int x_end = x + w, y_end = y + h;
+    int top, bottom, col;
+    
+    if (w <= 0 || h <= 0)
+        return;
+    
+    if (x < 0)
+        x = 0;
+    if (x_end > canvas->width)
+        x_end = canvas->width;
+    if (y < 0)
+        y = 0;
+    if (y_end > canvas->height)
+        y_end = canvas->height;
+    
+    // In each module row, a column of the rectangle is one masked byte
+    // update
+    for (top = y; top < y_end; top = bottom) {
+        bottom = (top / MODULE_SIZE + 1) * MODULE_SIZE;
+        if (bottom > y_end)
+            bottom = y_end;
+        mask = rows_mask(canvas, top, bottom);
+        for (col = x; col < x_end; col++)
+            column_apply(canvas, col, top, mask, on);
+    }
+}
+
+void canvas_bars(histogram_canvas_t *canvas, const uint8_t *heights, int count)
+{
+    size_t offset;
+    int x, h, lit;
+    
+    if (count > canvas->width)
+        count = canvas->width;
+    for (x = 0; x < count; x++) {
+        h = heights[x] < canvas->height ? heights[x] : canvas->height;
+        
+        // Bottom-up, a bar fills whole module columns, then part of one
+        for (offset = canvas->bytes; offset > 0; h -= lit) {
+            offset -= canvas->stride;
+            lit = h > MODULE_SIZE ? MODULE_SIZE : h;
+            canvas->framebuffer[canvas->col_byte[x] + offset] = canvas->span_mask[lit];
+        }
+    }
+}
+
+void canvas_sprite(histogram_canvas_t *canvas, int x, int y, const uint8_t sprite[8])
+{
+    int sx, sy;
+    
+    for (sy = 0; sy < 8; sy++) {
+        if (y + sy < 0 || y + sy >= canvas->height)
+            continue;
+        for (sx = 0; sx < 8; sx++) {
+            if (x + sx < 0 || x + sx >= canvas->width)
+                continue;
+            column_apply(canvas, x + sx, y + sy, canvas->row_mask[(y + sy) % MODULE_SIZE],
+                         (sprite[sy] & (0x80 >> sx)) != 0);
+        }
+    }
+}
+
+int canvas_commit(histogram_canvas_t *canvas)
+{
+    histogram_ctx_t *ctx;
+    uint8_t *entries;
+    size_t i, entry, changes = 0;
+    bool wide;
+    int result;
+    
+    if (canvas == NULL) {
+        fprintf(stderr, "Invalid canvas pointer\n");
+        return -1;
+    }
+    ctx = canvas->ctx;
+    
+    // Framebuffers over 256 bytes need two-byte indexes
+    wide = canvas->bytes > 256;
+    entry = wide ? 3 : 2;
+    
+    if (ctx->shown_valid) {
+        // Collect the module rows that differ from the displayed frame
+        entries = ctx->update + BLIT_HEADER_LEN;
+        for (i = 0; i < canvas->bytes; i++) {
+            if (canvas->framebuffer[i] != ctx->shown[i]) {
+                *entries++ = (uint8_t)i;
+                if (wide)
+                    *entries++ = (uint8_t)(i >> 8);
+                *entries++ = canvas->framebuffer[i];
+                changes++;
+            }
+        }
+        
+        if (changes == 0) {
+            stats_frame(false);
+            return 0;
+        }
+    }
+    
+    // A full frame is shorter once more than half (a third, for wide
+    // updates) of the rows changed; it already sits behind its blit header
+    if (ctx->shown_valid && entry * changes < canvas->bytes) {
+        blit_header(ctx->update, ctx, wide ? MAX7219_OP_UPDATE_WIDE : MAX7219_OP_UPDATE,
+                    entry * changes);
+        result = send_command(ctx, ctx->update, BLIT_HEADER_LEN + entry * changes,
+                              "frame update");
+    } else {
+        result = send_command(ctx, canvas->command, BLIT_HEADER_LEN + canvas->bytes, "frame");
+    }
+    
+    ctx->shown_valid = result == 0;
+    if (result == 0) {
+        memcpy(ctx->shown, canvas->framebuffer, canvas->bytes);
+        stats_frame(true);
+    }
+    ctx->histogram_shown = false;
+    return result;
+}
+
+static void *async_thread(void *arg)
+{
+    histogram_ctx_t *ctx = arg;
+    display_async_t *async = ctx->async;
+    uint64_t last_start = 0, start, cost, average;
+    unsigned previous;
+    int result;
+    
+    for (;;) {
+        sem_wait(&async->wake);
+        
+        if (!(atomic_load(&async->mailbox) & MAILBOX_FRESH)) {
+            if (atomic_load(&async->stop))
+                break;
+            continue;
+        }
+        
+        // Start at most one flush per measured flush period: frames
+        // arriving meanwhile replace each other in the mailbox
+        average = atomic_load(&async->flush_ns);
+        start = monotonic_ns();
+        if (last_start != 0 && start < last_start + average) {
+            struct timespec delay = {
+                .tv_sec = (time_t)((last_start + average - start) / 1000000000ull),
+                .tv_nsec = (long)((last_start + average - start) % 1000000000ull),
+            };
+            nanosleep(&delay, NULL);
+            start = monotonic_ns();
+        }
+        
+        previous = atomic_exchange(&async->mailbox, async->front);
+        async->front = previous & MAILBOX_SLOT;
+        
+        result = histogram_ctx_display(ctx, async->slots[async->front], ctx->config.width);
+        
+        cost = monotonic_ns() - start;
+        atomic_store(&async->flush_ns, average == 0 ? cost : (7 * average + cost) / 8);
+        atomic_store(&async->failed, result < 0);
+        atomic_fetch_add(&async->displayed, 1);
+        last_start = start;
+        
+        pthread_mutex_lock(&async->lock);
+        async->shown_seq = async->slot_seq[async->front];
+        pthread_cond_broadcast(&async->done);
+        pthread_mutex_unlock(&async->lock);
+    }
+    
+    return NULL;
+}
+
+static int async_start(histogram_ctx_t *ctx)
+{
+    display_async_t *async;
+    int i;
+    
+    async = calloc(1, sizeof(*async));
+    if (async == NULL) {
+        perror("Failed to allocate display thread state");
+        return -1;
+    }
+    
+    async->slots[0] = calloc(3, ctx->config.width);
+    if (async->slots[0] == NULL) {
+        perror("Failed to allocate display thread state");
+        free(async);
+        return -1;
+    }
+    for (i = 1; i < 3; i++)
+        async->slots[i] = async->slots[0] + i * ctx->config.width;
+    
+    // Slot 0 is the producer's, 1 sits in the mailbox, 2 is the thread's
+    async->back = 0;
+    atomic_init(&async->mailbox, 1);
+    async->front = 2;
+    
+    sem_init(&async->wake, 0, 0);
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->done, NULL);
+    
+    ctx->async = async;
+    if (pthread_create(&async->thread, NULL, async_thread, ctx) != 0) {
+        fprintf(stderr, "Failed to start display thread\n");
+        ctx->async = NULL;
+        sem_destroy(&async->wake);
+        pthread_mutex_destroy(&async->lock);
+        pthread_cond_destroy(&async->done);
+        free(async->slots[0]);
+        free(async);
+        return -1;
+    }
+    
+    return 0;
+}
+
+static void async_stop(histogram_ctx_t *ctx)
+{
+    display_async_t *async = ctx->async;
+    
+    if (async == NULL)
+        return;
+    
+    histogram_ctx_flush(ctx);
+    atomic_store(&async->stop, true);
+    sem_post(&async->wake);
+    pthread_join(async->thread, NULL);
+    
+    sem_destroy(&async->wake);
+    pthread_mutex_destroy(&async->lock);
+    pthread_cond_destroy(&async->done);
+    free(async->slots[0]);
+    free(async);
+    ctx->async = NULL;
+}
+
+int histogram_ctx_display_async(histogram_ctx_t *ctx, const uint8_t *histogram, int width)
+{
+    display_async_t *async;
+    unsigned previous;
+    
+    if (ctx == NULL) {
+        fprintf(stderr, "Driver not initialized\n");
+        return -1;
+    }
+    
+    if (histogram == NULL) {
+        fprintf(stderr, "Invalid histogram pointer\n");
+        return -1;
+    }
+    
+    if (width != ctx->config.width) {
+        fprintf(stderr, "Histogram width (%d) doesn't match hardware width (%d)\n",
+                width, ctx->config.width);
+        return -1;
+    }
+    
+    if (ctx->async == NULL && async_start(ctx) < 0)
+        return -1;
+    async = ctx->async;
+    
+    // Fill the private back slot, then publish it in one exchange
+    memcpy(async->slots[async->back], histogram, width);
+    async->slot_seq[async->back] = ++async->next_seq;
+    atomic_store(&async->submitted, async->next_seq);
+    
+    previous = atomic_exchange(&async->mailbox, async->back | MAILBOX_FRESH);
+    async->back = previous & MAILBOX_SLOT;
+    if (previous & MAILBOX_FRESH)
+        atomic_fetch_add(&async->dropped, 1);
+    
+    sem_post(&async->wake);
+    return 0;
+}
+
+int histogram_ctx_flush(histogram_ctx_t *ctx)
+{
+    display_async_t *async;
+    uint64_t target;
+    
+    if (ctx == NULL) {
+        fprintf(stderr, "Driver not initialized\n");
+        return -1;
+    }
+    
+    async = ctx->async;
+    if (async == NULL)
+        return 0;
+    
+    // Dropped frames count as done once a later one is shown
+    target = atomic_load(&async->submitted);
+    pthread_mutex_lock(&async->lock);
+    while (async->shown_seq < target)
+        pthread_cond_wait(&async->done, &async->lock);
+    pthread_mutex_unlock(&async->lock);
+    
+    return atomic_load(&async->failed) ? -1 : 0;
+}
+
+int histogram_ctx_get_async_stats(const histogram_ctx_t *ctx, histogram_async_stats_t *stats)
+{
+    if (ctx == NULL || stats == NULL) {
+        fprintf(stderr, "Invalid arguments\n");
+        return -1;
+    }
+    
+    memset(stats, 0, sizeof(*stats));
+    if (ctx->async != NULL) {
+        stats->submitted = atomic_load(&ctx->async->submitted);
+        stats->displayed = atomic_load(&ctx->async->displayed);
+        stats->dropped = atomic_load(&ctx->async->dropped);
+        stats->flush_ns = atomic_load(&ctx->async->flush_ns);
+    }
+    return 0;
+}
+
+// Original API: thin wrappers around a process-wide default context
+
+int histogram_init(void)
+{
+    histogram_ctx_t *ctx;
+    
+    if (default_ctx != NULL)
+        histogram_cleanup();
+    
+    ctx = histogram_ctx_open(NULL);
+    if (ctx == NULL)
+        return -1;
+    default_ctx = ctx;
+    
+    printf("Hardware detected: %d matrices, %dx%d resolution\n",
+           ctx->config.matrices, ctx->config.width, ctx->config.height);
+    
+    return 0;
+}
+
+void histogram_cleanup(void)
+{
+    histogram_ctx_close(default_ctx);
+    default_ctx = NULL;
+}
+
+int histogram_get_hw_config(histogram_hw_config_t *config)
+{
+    device_t device;
+    
+    if (config == NULL) {
+        fprintf(stderr, "Invalid config pointer\n");
+        return -1;
+    }
+    
+    if (default_ctx != NULL)
+        return histogram_ctx_get_hw_config(default_ctx, config);
+    
+    if (!probed_config_valid) {
+        // Called before histogram_init(): query on a temporary descriptor
+        if (device_open(NULL, &device) < 0)
+            return -1;
+        if (query_hw_config(&device, &probed_config, NULL) < 0) {
+            device_close(&device);
+            return -1;
+        }
+        device_close(&device);
+        probed_config_valid = true;
+    }
+    
+    *config = probed_config;
+    return 0;
+}
+
+int histogram_display(const uint8_t *histogram, int width)
+{
+    return histogram_ctx_display(default_ctx, histogram, width);
+}
+
+int histogram_display_auto(const uint32_t histogram[256])
+{
+    return histogram_ctx_display_auto(default_ctx, histogram);
+}
+
+int matrix_set_pixel(int x, int y, bool on)
+{
+    return histogram_ctx_set_pixel(default_ctx, x, y, on);
+}
+
+int histogram_clear(void)
+{
+    return histogram_ctx_clear(default_ctx);
+}
+
+int histogram_set_brightness(int level)
+{
+    return histogram_ctx_set_brightness(default_ctx, level);
+}
+
+int histogram_display_async(const uint8_t *histogram, int width)
+{
+    return histogram_ctx_display_async(default_ctx, histogram, width);
+}
+
+int histogram_display_flush(void)
+{
+    return histogram_ctx_flush(default_ctx);
+}
+
+int histogram_get_async_stats(histogram_async_stats_t *stats)
+{
+    return histogram_ctx_get_async_stats(default_ctx, stats);
+}
+
+const char *histogram_op_name(histogram_op_t op)
+{
+    return op >= 0 && op < HISTOGRAM_OP_COUNT ? op_names[op] : "unknown";
+}
+
+// Upper edge of the bucket holding the rank-th sample, capped at max
+static uint64_t latency_percentile(const histogram_op_stats_t *op, double fraction)
+{
+    uint64_t rank, seen = 0;
+    int b;
+    
+    if (op->calls == 0)
+        return 0;
+    rank = (uint64_t)(fraction * (op->calls - 1)) + 1;
+    for (b = 0; b < HISTOGRAM_LATENCY_BUCKETS; b++) {
+        seen += op->buckets[b];
+        if (seen >= rank)
+            break;
+    }
+    if (b == 0)
+        return 0;
+    if (b >= 64 || ((1ull << b) - 1) > op->max_ns)
+        return op->max_ns;
+    return (1ull << b) - 1;
+}
+
+int histogram_get_stats(histogram_stats_t *out)
+{
+    histogram_op_stats_t *op;
+    uint64_t start;
+    int i, b;
+    
+    if (out == NULL) {
+        fprintf(stderr, "Invalid stats pointer\n");
+        return -1;
+    }
+    
+    memset(out, 0, sizeof(*out));
+    for (i = 0; i < HISTOGRAM_OP_COUNT; i++) {
+        op = &out->ops[i];
+        op->calls = atomic_load_explicit(&stats.ops[i].calls, memory_order_relaxed);
+        op->errors = atomic_load_explicit(&stats.ops[i].errors, memory_order_relaxed);
+        op->bytes = atomic_load_explicit(&stats.ops[i].bytes, memory_order_relaxed);
+        op->total_ns = atomic_load_explicit(&stats.ops[i].total_ns, memory_order_relaxed);
+        op->max_ns = atomic_load_explicit(&stats.ops[i].max_ns, memory_order_relaxed);
+        for (b = 0; b < HISTOGRAM_LATENCY_BUCKETS; b++)
+            op->buckets[b] = atomic_load_explicit(&stats.ops[i].buckets[b],
+                                                  memory_order_relaxed);
+        op->p50_ns = latency_percentile(op, 0.50);
+        op->p99_ns = latency_percentile(op, 0.99);
+    }
+    
+    out->frames = atomic_load_explicit(&stats.frames, memory_order_relaxed);
+    out->unchanged = atomic_load_explicit(&stats.unchanged, memory_order_relaxed);
+    start = atomic_load_explicit(&stats.start_ns, memory_order_relaxed);
+    if (start != 0) {
+        out->elapsed_ns = monotonic_ns() - start;
+        if (out->elapsed_ns > 0)
+            out->fps = out->frames * 1e9 / (double)out->elapsed_ns;
+    }
+    
+    return 0;
+}
+
+void histogram_reset_stats(void)
+{
+    int i, b;
+    
+    for (i = 0; i < HISTOGRAM_OP_COUNT; i++) {
+        atomic_store(&stats.ops[i].calls, 0);
+        atomic_store(&stats.ops[i].errors, 0);
+        atomic_store(&stats.ops[i].bytes, 0);
+        atomic_store(&stats.ops[i].total_ns, 0);
+        atomic_store(&stats.ops[i].max_ns, 0);
+        for (b = 0; b < HISTOGRAM_LATENCY_BUCKETS; b++)
+            atomic_store(&stats.ops[i].buckets[b], 0);
+    }
+    atomic_store(&stats.frames, 0);
+    atomic_store(&stats.unchanged, 0);
+    atomic_store(&stats.start_ns, 0);
+    atomic_store(&stats.dump_frames, 0);
+    atomic_store(&stats.next_dump_ns, 0);
+}
+
+void histogram_set_stats_interval(double seconds)
+{
+    atomic_store(&stats.dump_configured, true);
+    atomic_store(&stats.dump_interval_ns, seconds > 0 ? (uint64_t)(seconds * 1e9) : 0);
+    atomic_store(&stats.next_dump_ns, 0);
+}
+
+void histogram_print_stats(FILE *out, const histogram_stats_t *snapshot)
+{
+    const histogram_op_stats_t *op;
+    int i;
+    
+    fprintf(out, "  %llu frames (%llu unchanged), %.1f fps over %.1f s\n",
+            (unsigned long long)snapshot->frames, (unsigned long long)snapshot->unchanged,
+            snapshot->fps, snapshot->elapsed_ns / 1e9);
+    for (i = 0; i < HISTOGRAM_OP_COUNT; i++) {
+        op = &snapshot->ops[i];
+        if (op->calls == 0)
+            continue;
+        fprintf(out, "  %-10s %8llu calls %6llu errors %10llu bytes  "
+                "avg %8.1f us  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+                histogram_op_name((histogram_op_t)i),
+                (unsigned long long)op->calls, (unsigned long long)op->errors,
+                (unsigned long long)op->bytes, op->total_ns / 1e3 / op->calls,
+                op->p50_ns / 1e3, op->p99_ns / 1e3, op->max_ns / 1e3);
+    }
+}
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include "histogram_sim.h"
 
 /**
  * @brief Hardware configuration structure
@@ -15,12 +17,22 @@ typedef struct {
 
 /**
  * @brief Initialize the histogram display system
+ *
+ * Opens /proc/max7219, or the device named by HISTOGRAM_DEVICE_ENV
+ * ("sim..." for the in-process simulator, see histogram_sim.h).
+ *
  * @return 0 on success, -1 on failure
  */
 int histogram_init(void);
 
 /**
  * @brief Get hardware configuration from driver
+ *
+ * The geometry is negotiated once with a binary query (falling back to
+ * the text format of older drivers) and cached by histogram_init().
+ * Later calls copy the cached struct without any system call or output.
+ * Called before histogram_init(), it queries the driver once itself.
+ *
  * @param config Pointer to store hardware configuration
  * @return 0 on success, -1 on failure
  */
@@ -33,6 +45,9 @@ int histogram_get_hw_config(histogram_hw_config_t *config);
  * that fits the hardware display dimensions. Groups intensities into
  * buckets matching the display width and scales heights to fit display height.
  * 
+ * Builds a linear histogram_plan_t for the call; see histogram_plan_create()
+ * for the rebinning rules.
+ * 
  * @param input_histogram Input histogram with 256 intensity values
  * @param output_histogram Output array (must be allocated with size = hw_width)
  * @param hw_width Hardware display width (number of columns)
@@ -44,6 +59,64 @@ int histogram_dimension(const uint32_t input_histogram[256],
                        int hw_width,
                        int hw_height);
 
+/**
+ * @brief Bar height scaling used by a dimensioning plan
+ */
+typedef enum {
+    HISTOGRAM_SCALE_LINEAR = 0,  /**< height proportional to the count */
+    HISTOGRAM_SCALE_SQRT,        /**< height proportional to sqrt(count) */
+    HISTOGRAM_SCALE_LOG          /**< HISTOGRAM_LOG_DECADES decades below the max */
+} histogram_scale_t;
+
+/**
+ * @brief Decades of dynamic range shown by HISTOGRAM_SCALE_LOG
+ *
+ * A column at 1/1000 of the tallest one still lights one LED; anything
+ * smaller is empty.
+ */
+#define HISTOGRAM_LOG_DECADES 3
+
+/**
+ * @brief Precompiled rebinning from a histogram to display bars
+ */
+typedef struct histogram_plan histogram_plan_t;
+
+/**
+ * @brief Build a dimensioning plan
+ *
+ * Column c covers input bins [c * input_bins / width, (c + 1) *
+ * input_bins / width): when the width doesn't divide the input, a bin
+ * on a boundary is split between its two columns with Q16 weights, so
+ * no bin is lost. Column sums are 64-bit. Heights are normalized to the
+ * tallest column with one fixed-point reciprocal and mapped through a
+ * precomputed threshold table for the scale mode, so applying the plan
+ * is branch-free apart from loop bounds.
+ *
+ * @param input_bins Bins of the input histogram (width to 256)
+ * @param width Output columns (1 to input_bins)
+ * @param height Maximum bar height (1 to 255)
+ * @param scale Scale mode
+ * @return Plan handle, or NULL on invalid arguments
+ */
+histogram_plan_t *histogram_plan_create(int input_bins, int width, int height,
+                                        histogram_scale_t scale);
+
+/**
+ * @brief Dimension a histogram with a plan
+ *
+ * @param plan Plan from histogram_plan_create()
+ * @param input_histogram Input histogram (input_bins entries)
+ * @param output_histogram Output bar heights (width entries)
+ * @return 0 on success, -1 on failure
+ */
+int histogram_plan_apply(const histogram_plan_t *plan, const uint32_t *input_histogram,
+                         uint8_t *output_histogram);
+
+/**
+ * @brief Free a plan
+ */
+void histogram_plan_destroy(histogram_plan_t *plan);
+
 /**
  * @brief Display a pre-dimensioned histogram on hardware
  * 
@@ -54,7 +127,9 @@ int histogram_dimension(const uint32_t input_histogram[256],
  * NOTE: This function automatically applies a 90° clockwise rotation
  * to accommodate the physical orientation of the display hardware.
  * Users provide data in logical orientation, and the library handles
- * the transformation transparently.
+ * the transformation transparently. Drivers that accept binary blits
+ * get the bars already rendered into their framebuffer layout, and only
+ * the rows that changed are sent.
  * 
  * @param histogram Dimensioned histogram array (size = hw_width)
  * @param width Width of the histogram (must match hardware width)
@@ -74,11 +149,150 @@ int histogram_display(const uint8_t *histogram, int width);
  */
 int histogram_display_auto(const uint32_t histogram[256]);
 
+/**
+ * @brief Queue a pre-dimensioned histogram for display without blocking
+ *
+ * The histogram is copied and handed to a display thread (started on
+ * the first call) through a single-slot "latest frame wins" mailbox, so
+ * the caller never waits for the SPI flush. If the thread hasn't taken
+ * the previous frame yet, that frame is dropped and counted. The thread
+ * starts at most one flush per measured flush time, so bursts collapse
+ * into their latest frame.
+ *
+ * Submit from one thread at a time, and don't mix with the synchronous
+ * display calls until histogram_display_flush() returns.
+ *
+ * @param histogram Dimensioned histogram array (size = hw_width)
+ * @param width Width of the histogram (must match hardware width)
+ * @return 0 on success, -1 on failure
+ */
+int histogram_display_async(const uint8_t *histogram, int width);
+
+/**
+ * @brief Wait until the last histogram queued with histogram_display_async()
+ * is on the display
+ * @return 0 on success, -1 if that flush failed
+ */
+int histogram_display_flush(void);
+
+/**
+ * @brief Counters of the asynchronous display path
+ */
+typedef struct {
+    uint64_t submitted;   /**< Frames queued */
+    uint64_t displayed;   /**< Frames flushed to the display */
+    uint64_t dropped;     /**< Frames replaced before the thread took them */
+    uint64_t flush_ns;    /**< Moving average of one flush */
+} histogram_async_stats_t;
+
+/**
+ * @brief Read the asynchronous display counters (all zero before the first
+ * histogram_display_async())
+ * @return 0 on success, -1 on failure
+ */
+int histogram_get_async_stats(histogram_async_stats_t *stats);
+
+/**
+ * @brief Operations timed by the library's instrumentation
+ *
+ * Display, clear, pixel and brightness time their write() to the
+ * driver; dimension times histogram_dimension(), histogram_plan_apply()
+ * and the dimensioning step of histogram_display_auto().
+ */
+typedef enum {
+    HISTOGRAM_OP_DISPLAY = 0,
+    HISTOGRAM_OP_CLEAR,
+    HISTOGRAM_OP_PIXEL,
+    HISTOGRAM_OP_BRIGHTNESS,
+    HISTOGRAM_OP_DIMENSION,
+    HISTOGRAM_OP_COUNT
+} histogram_op_t;
+
+/**
+ * @brief Latency buckets per operation
+ *
+ * Bucket 0 counts 0 ns, bucket b > 0 counts latencies in
+ * [2^(b-1), 2^b) ns; the last bucket also takes everything longer.
+ */
+#define HISTOGRAM_LATENCY_BUCKETS 40
+
+/**
+ * @brief Environment variable enabling the periodic stats dump
+ *
+ * Seconds between dumps to stderr, e.g. HISTOGRAM_STATS=5. Read at the
+ * first frame unless histogram_set_stats_interval() was called.
+ */
+#define HISTOGRAM_STATS_ENV "HISTOGRAM_STATS"
+
+/**
+ * @brief Counters of one operation
+ */
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;        /**< Failed write() calls */
+    uint64_t bytes;         /**< Bytes written to the driver */
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t p50_ns;        /**< Upper edge of the median's bucket */
+    uint64_t p99_ns;        /**< Upper edge of the 99th percentile's bucket */
+    uint64_t buckets[HISTOGRAM_LATENCY_BUCKETS];
+} histogram_op_stats_t;
+
+/**
+ * @brief Snapshot of the library's instrumentation
+ */
+typedef struct {
+    histogram_op_stats_t ops[HISTOGRAM_OP_COUNT];
+    uint64_t frames;        /**< Histograms and canvases shown */
+    uint64_t unchanged;     /**< Of those, frames already on the display */
+    uint64_t elapsed_ns;    /**< Since the first frame */
+    double fps;             /**< frames over elapsed_ns */
+} histogram_stats_t;
+
+/**
+ * @brief Read the library's counters
+ *
+ * The counters are process-wide (every context adds to them), always on
+ * and lock-free: each operation takes two monotonic clock reads and a
+ * few relaxed atomic increments. The snapshot isn't atomic as a whole;
+ * counters updated while it is taken may be off by the calls in flight.
+ *
+ * @param stats Output snapshot
+ * @return 0 on success, -1 on failure
+ */
+int histogram_get_stats(histogram_stats_t *stats);
+
+/**
+ * @brief Zero every counter; fps restarts at the next frame
+ */
+void histogram_reset_stats(void);
+
+/**
+ * @brief Dump the counters to stderr every @p seconds (0 turns it off)
+ *
+ * The dump is printed by whichever thread shows a frame once the
+ * interval has passed, so there is no extra thread and no dump while
+ * nothing is displayed. Overrides HISTOGRAM_STATS_ENV.
+ */
+void histogram_set_stats_interval(double seconds);
+
+/**
+ * @brief Print a snapshot, one line per operation that was used
+ */
+void histogram_print_stats(FILE *out, const histogram_stats_t *stats);
+
+/**
+ * @brief Name of an operation ("display", "clear", ...)
+ */
+const char *histogram_op_name(histogram_op_t op);
+
 /**
  * @brief Set a specific pixel on the display
  * 
  * NOTE: Coordinates are in logical orientation. This function automatically
- * applies a 90° clockwise rotation to match the physical display orientation.
+ * applies a 90° clockwise rotation to each 8x8 module to match the physical
+ * display orientation (the same layout as histogram_canvas_t). Each call is
+ * one write() and one display refresh; use a canvas to draw many pixels.
  * Users work with logical coordinates (x=0 is left, y=0 is top), and the
  * library handles the physical transformation.
  * 
@@ -108,4 +322,166 @@ int histogram_set_brightness(int level);
  */
 void histogram_cleanup(void);
 
+/**
+ * @brief Handle to one display, independent of the global API
+ *
+ * A context owns its driver descriptor, the negotiated geometry and
+ * display buffers preallocated from that geometry, so the display path
+ * doesn't allocate. Contexts share no state: different contexts
+ * (including contexts on different displays) can be used from different
+ * threads at the same time. A single context must not be used by two
+ * threads at once.
+ *
+ * The functions above (histogram_init(), histogram_display(), ...) are
+ * wrappers around a process-wide default context.
+ */
+typedef struct histogram_ctx histogram_ctx_t;
+
+/**
+ * @brief Open a display and negotiate its geometry
+ *
+ * Clears the display, like histogram_init().
+ *
+ * @param path Driver path or simulator device ("sim:render,..."), NULL
+ *             for HISTOGRAM_DEVICE_ENV or else /proc/max7219
+ * @return Context handle, or NULL on failure
+ */
+histogram_ctx_t *histogram_ctx_open(const char *path);
+
+/**
+ * @brief Clear the display, close it and free the context
+ */
+void histogram_ctx_close(histogram_ctx_t *ctx);
+
+/**
+ * @brief Simulator behind a context
+ * @return The simulator, or NULL when the context drives real hardware
+ */
+histogram_sim_t *histogram_ctx_sim(const histogram_ctx_t *ctx);
+
+/**
+ * @brief Copy the geometry negotiated by histogram_ctx_open()
+ * @return 0 on success, -1 on failure
+ */
+int histogram_ctx_get_hw_config(const histogram_ctx_t *ctx, histogram_hw_config_t *config);
+
+/**
+ * @brief histogram_display() on a context
+ *
+ * The rotated bars are written into the context's preformatted command
+ * buffer and sent with a single write().
+ */
+int histogram_ctx_display(histogram_ctx_t *ctx, const uint8_t *histogram, int width);
+
+/**
+ * @brief histogram_display_auto() on a context, dimensioning into its scratch
+ */
+int histogram_ctx_display_auto(histogram_ctx_t *ctx, const uint32_t histogram[256]);
+
+/**
+ * @brief matrix_set_pixel() on a context
+ */
+int histogram_ctx_set_pixel(histogram_ctx_t *ctx, int x, int y, bool on);
+
+/**
+ * @brief histogram_clear() on a context
+ */
+int histogram_ctx_clear(histogram_ctx_t *ctx);
+
+/**
+ * @brief histogram_set_brightness() on a context
+ */
+int histogram_ctx_set_brightness(histogram_ctx_t *ctx, int level);
+
+/**
+ * @brief histogram_display_async() on a context
+ */
+int histogram_ctx_display_async(histogram_ctx_t *ctx, const uint8_t *histogram, int width);
+
+/**
+ * @brief histogram_display_flush() on a context
+ */
+int histogram_ctx_flush(histogram_ctx_t *ctx);
+
+/**
+ * @brief histogram_get_async_stats() on a context
+ */
+int histogram_ctx_get_async_stats(const histogram_ctx_t *ctx, histogram_async_stats_t *stats);
+
+/**
+ * @brief Off-screen drawing surface for a display
+ *
+ * Drawing happens in a local bit-packed copy of the driver framebuffer
+ * laid out with the display rotation already applied: a logical column
+ * is one byte per row of modules and a logical row one bit of it, so a
+ * vertical line or a bar is a masked byte update per module row.
+ * Nothing reaches the driver until canvas_commit(), which sends the
+ * frame as one binary blit and costs one SPI refresh. Coordinates are
+ * logical (x = 0 left, y = 0 top) and primitives clip to the canvas.
+ */
+typedef struct histogram_canvas histogram_canvas_t;
+
+/**
+ * @brief Create a blank canvas for a context
+ * @param ctx Display context, NULL for the histogram_init() display
+ * @return Canvas handle, or NULL on failure (including drivers without
+ *         binary blits and geometries that 8x8 modules don't tile)
+ */
+histogram_canvas_t *canvas_create(histogram_ctx_t *ctx);
+
+/**
+ * @brief Free a canvas (the display keeps showing the last commit)
+ */
+void canvas_destroy(histogram_canvas_t *canvas);
+
+/**
+ * @brief Turn every pixel off
+ */
+void canvas_clear(histogram_canvas_t *canvas);
+
+/**
+ * @brief Set one pixel
+ */
+void canvas_pixel(histogram_canvas_t *canvas, int x, int y, bool on);
+
+/**
+ * @brief Horizontal line of @p len pixels starting at (x, y)
+ */
+void canvas_hline(histogram_canvas_t *canvas, int x, int y, int len, bool on);
+
+/**
+ * @brief Vertical line of @p len pixels starting at (x, y) going down
+ */
+void canvas_vline(histogram_canvas_t *canvas, int x, int y, int len, bool on);
+
+/**
+ * @brief Filled rectangle
+ */
+void canvas_rect(histogram_canvas_t *canvas, int x, int y, int w, int h, bool on);
+
+/**
+ * @brief Replace columns 0 to count - 1 with bars rising from the bottom
+ *
+ * Takes the output of histogram_dimension() directly.
+ *
+ * @param canvas Canvas
+ * @param heights Bar heights, clamped to the canvas height
+ * @param count Number of bars (at most the canvas width)
+ */
+void canvas_bars(histogram_canvas_t *canvas, const uint8_t *heights, int count);
+
+/**
+ * @brief Copy an 8x8 sprite with its top-left corner at (x, y)
+ *
+ * @param sprite Eight rows, MSB is the leftmost pixel; clear bits turn
+ *               pixels off (the sprite is opaque)
+ */
+void canvas_sprite(histogram_canvas_t *canvas, int x, int y, const uint8_t sprite[8]);
+
+/**
+ * @brief Send the canvas to the display in a single write()
+ * @return 0 on success, -1 on failure
+ */
+int canvas_commit(histogram_canvas_t *canvas);
+
 #endif // HISTOGRAM_LIB_H
\ No newline at end of file
@@ -0,0 +1,159 @@
+#define _DEFAULT_SOURCE
+#include "histogram_mmap.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Parse one unsigned header number, skipping whitespace and '#' comments
+static int netpbm_number(const uint8_t *data, size_t size, size_t *pos, int *value)
+{
+    long n = 0;
+
+    while (*pos < size) {
+        if (data[*pos] == '#') {
+            while (*pos < size && data[*pos] != '\n')
+                (*pos)++;
+        } else if (isspace(data[*pos])) {
+            (*pos)++;
+        } else {
+            break;
+        }
+    }
+
+    if (*pos >= size || !isdigit(data[*pos]))
+        return -1;
+    while (*pos < size && isdigit(data[*pos])) {
+        n = n * 10 + (data[*pos] - '0');
+        if (n > 1000000)
+            return -1;
+        (*pos)++;
+    }
+
+    *value = (int)n;
+    return 0;
+}
+
+static int parse_netpbm(const uint8_t *data, size_t size, mapped_image_t *image)
+{
+    size_t pos = 2;
+    int maxval;
+
+    image->channels = data[1] == '5' ? 1 : 3;
+    if (netpbm_number(data, size, &pos, &image->width) < 0 ||
+        netpbm_number(data, size, &pos, &image->height) < 0 ||
+        netpbm_number(data, size, &pos, &maxval) < 0) {
+        fprintf(stderr, "Invalid PGM/PPM header\n");
+        return -1;
+    }
+    if (maxval <= 0 || maxval > 255) {
+        fprintf(stderr, "Unsupported PGM/PPM maxval %d (only 8-bit)\n", maxval);
+        return -1;
+    }
+
+    // Exactly one whitespace byte separates the header from the pixels
+    image->pixels = data + pos + 1;
+    return (size_t)(image->pixels - data) <= size ? 0 : -1;
+}
+
+static int parse_raw(const uint8_t *data, size_t size, mapped_image_t *image)
+{
+    int header[2];
+
+    if (size < sizeof(header)) {
+        fprintf(stderr, "Raw image too short\n");
+        return -1;
+    }
+
+    memcpy(header, data, sizeof(header));
+    image->width = header[0];
+    image->height = header[1];
+    image->channels = 1;
+    image->pixels = data + sizeof(header);
+    return 0;
+}
+
+int mapped_image_supported(const char *path)
+{
+    static const char *const extensions[] = { ".pgm", ".ppm", ".pnm", ".raw", NULL };
+    const char *dot = path ? strrchr(path, '.') : NULL;
+    int i;
+
+    if (dot == NULL)
+        return 0;
+    for (i = 0; extensions[i] != NULL; i++) {
+        if (strcasecmp(dot, extensions[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+int mapped_image_open(const char *path, mapped_image_t *image)
+{
+    const uint8_t *data;
+    struct stat st;
+    size_t needed;
+    int fd, result;
+
+    if (path == NULL || image == NULL) {
+        fprintf(stderr, "Invalid arguments\n");
+        return -1;
+    }
+    memset(image, 0, sizeof(*image));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        fprintf(stderr, "Empty or unreadable image: %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    image->map_size = (size_t)st.st_size;
+    image->map = mmap(NULL, image->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image->map == MAP_FAILED) {
+        perror("Failed to map image");
+        image->map = NULL;
+        return -1;
+    }
+
+    // One front-to-back pass: let the kernel read ahead and drop behind
+    madvise(image->map, image->map_size, MADV_SEQUENTIAL);
+
+    data = image->map;
+    if (image->map_size >= 2 && data[0] == 'P' && (data[1] == '5' || data[1] == '6'))
+        result = parse_netpbm(data, image->map_size, image);
+    else
+        result = parse_raw(data, image->map_size, image);
+
+    if (result == 0) {
+        needed = (size_t)(image->pixels - data) +
+                 (size_t)image->width * image->height * image->channels;
+        if (image->width <= 0 || image->height <= 0 || needed > image->map_size) {
+            fprintf(stderr, "Image data truncated or invalid: %s (%dx%d)\n",
+                    path, image->width, image->height);
+            result = -1;
+        }
+    }
+
+    if (result < 0)
+        mapped_image_close(image);
+    return result;
+}
+
+void mapped_image_close(mapped_image_t *image)
+{
+    if (image == NULL)
+        return;
+    if (image->map != NULL)
+        munmap(image->map, image->map_size);
+    memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,47 @@
+#ifndef HISTOGRAM_MMAP_H
+#define HISTOGRAM_MMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief An uncompressed image mapped straight from its file
+ */
+typedef struct {
+    void *map;                /**< Start of the mapping */
+    size_t map_size;          /**< Mapping length (whole file) */
+    const uint8_t *pixels;    /**< First pixel, inside the mapping */
+    int width;
+    int height;
+    int channels;             /**< 1 (PGM/raw) or 3 (PPM) */
+} mapped_image_t;
+
+/**
+ * @brief Check whether a path names a format mapped_image_open() handles
+ *
+ * Matches the .pgm, .ppm, .pnm and .raw extensions (case-insensitive).
+ */
+int mapped_image_supported(const char *path);
+
+/**
+ * @brief Map an uncompressed image without copying its pixels
+ *
+ * Accepts binary PGM (P5) and PPM (P6) with maxval <= 255, and the raw
+ * format written by save_raw_image() in Cluster/src/image_utils.c (native
+ * int width, native int height, width * height gray bytes). The file is
+ * mapped read-only with MADV_SEQUENTIAL so the kernel reads ahead
+ * aggressively, and @c pixels points into the mapping: no allocation and
+ * no copy, the histogram kernel reads the page cache directly.
+ *
+ * @param path Image path
+ * @param image Output mapping
+ * @return 0 on success, -1 on failure
+ */
+int mapped_image_open(const char *path, mapped_image_t *image);
+
+/**
+ * @brief Unmap an image opened with mapped_image_open()
+ */
+void mapped_image_close(mapped_image_t *image);
+
+#endif // HISTOGRAM_MMAP_H
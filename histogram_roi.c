@@ -0,0 +1,221 @@
+#include "histogram_roi.h"
+#include "histogram_compute.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct histogram_index {
+    int width;
+    int height;
+    int tile;
+    int bins;
+    int shift;          // luma >> shift = bin
+    int tiles_x;        // tile columns, the last one may be partial
+    int tiles_y;
+    uint8_t *luma;
+    uint32_t *cumulative;  // (tiles_y + 1) * (tiles_x + 1) corners of bins each
+};
+
+static inline uint32_t *corner(const histogram_index_t *index, int tx, int ty)
+{
+    return index->cumulative + ((size_t)ty * (index->tiles_x + 1) + tx) * index->bins;
+}
+
+// Count a rectangle straight from the luma plane
+static void count_rect(const histogram_index_t *index, int x, int y, int w, int h,
+                       uint32_t *histogram)
+{
+    const uint8_t *row;
+    int r, c;
+
+    for (r = y; r < y + h; r++) {
+        row = index->luma + (size_t)r * index->width + x;
+        for (c = 0; c < w; c++)
+            histogram[row[c] >> index->shift]++;
+    }
+}
+
+static int build(histogram_index_t *index)
+{
+    uint32_t *tile_hist, *acc, *above, *out;
+    int tx, ty, x0, y0, w, h, b;
+
+    tile_hist = calloc((size_t)index->tiles_x * index->bins, sizeof(uint32_t));
+    acc = malloc((size_t)index->bins * sizeof(uint32_t));
+    if (tile_hist == NULL || acc == NULL) {
+        free(tile_hist);
+        free(acc);
+        return -1;
+    }
+
+    for (ty = 0; ty < index->tiles_y; ty++) {
+        y0 = ty * index->tile;
+        h = index->height - y0 < index->tile ? index->height - y0 : index->tile;
+
+        // Histogram of every tile in this band, walking the rows in order
+        memset(tile_hist, 0, (size_t)index->tiles_x * index->bins * sizeof(uint32_t));
+        for (tx = 0; tx < index->tiles_x; tx++) {
+            x0 = tx * index->tile;
+            w = index->width - x0 < index->tile ? index->width - x0 : index->tile;
+            count_rect(index, x0, y0, w, h, tile_hist + (size_t)tx * index->bins);
+        }
+
+        // corner(tx + 1, ty + 1) = corner(tx + 1, ty) + tiles [0, tx] of this band
+        memset(acc, 0, (size_t)index->bins * sizeof(uint32_t));
+        for (tx = 0; tx < index->tiles_x; tx++) {
+            above = corner(index, tx + 1, ty);
+            out = corner(index, tx + 1, ty + 1);
+            for (b = 0; b < index->bins; b++) {
+                acc[b] += tile_hist[(size_t)tx * index->bins + b];
+                out[b] = above[b] + acc[b];
+            }
+        }
+    }
+
+    free(tile_hist);
+    free(acc);
+    return 0;
+}
+
+histogram_index_t *histogram_index_create(const unsigned char *image_data, int width, int height,
+                                          int channels, int tile, int bins)
+{
+    histogram_index_t *index;
+    size_t pixels, i;
+    int shift = 0;
+
+    if (image_data == NULL || width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+        fprintf(stderr, "Invalid arguments\n");
+        return NULL;
+    }
+    if (tile <= 0)
+        tile = HISTOGRAM_INDEX_DEFAULT_TILE;
+    if (bins <= 0)
+        bins = HISTOGRAM_INDEX_DEFAULT_BINS;
+    if (bins > 256 || (bins & (bins - 1)) != 0) {
+        fprintf(stderr, "Index bins must be a power of two up to 256: %d\n", bins);
+        return NULL;
+    }
+    while ((256 >> shift) > bins)
+        shift++;
+
+    index = calloc(1, sizeof(*index));
+    if (index == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return NULL;
+    }
+    index->width = width;
+    index->height = height;
+    index->tile = tile;
+    index->bins = bins;
+    index->shift = shift;
+    index->tiles_x = (width + tile - 1) / tile;
+    index->tiles_y = (height + tile - 1) / tile;
+
+    pixels = (size_t)width * height;
+    index->luma = malloc(pixels);
+    // Row 0 and column 0 of the corner table stay zero
+    index->cumulative = calloc((size_t)(index->tiles_x + 1) * (index->tiles_y + 1) * bins,
+                               sizeof(uint32_t));
+    if (index->luma == NULL || index->cumulative == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        histogram_index_destroy(index);
+        return NULL;
+    }
+
+    if (channels >= 3) {
+        for (i = 0; i < pixels; i++) {
+            const unsigned char *p = image_data + i * channels;
+            index->luma[i] = HISTOGRAM_LUMA(p[0], p[1], p[2]);
+        }
+    } else if (channels == 2) {
+        for (i = 0; i < pixels; i++)
+            index->luma[i] = image_data[i * 2];
+    } else {
+        memcpy(index->luma, image_data, pixels);
+    }
+
+    if (build(index) < 0) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        histogram_index_destroy(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+int histogram_index_bins(const histogram_index_t *index)
+{
+    return index != NULL ? index->bins : 0;
+}
+
+// Tile boundary t in pixels; the last boundary is the image edge
+static inline int tile_edge(int t, int tile, int limit)
+{
+    return t * tile < limit ? t * tile : limit;
+}
+
+int64_t histogram_index_query(const histogram_index_t *index, int x, int y, int w, int h,
+                              uint32_t *histogram)
+{
+    const uint32_t *a, *b, *c, *d;
+    int tx0, tx1, ty0, ty1, xa, xb, ya, yb, k;
+
+    if (index == NULL || histogram == NULL || x < 0 || y < 0 || w <= 0 || h <= 0 ||
+        w > index->width - x || h > index->height - y)
+        return -1;
+
+    memset(histogram, 0, (size_t)index->bins * sizeof(uint32_t));
+
+    // Whole tiles inside the rectangle; a rectangle reaching the right or
+    // bottom edge also covers the partial tile there
+    tx0 = (x + index->tile - 1) / index->tile;
+    ty0 = (y + index->tile - 1) / index->tile;
+    tx1 = x + w == index->width ? index->tiles_x : (x + w) / index->tile;
+    ty1 = y + h == index->height ? index->tiles_y : (y + h) / index->tile;
+
+    if (tx0 >= tx1 || ty0 >= ty1) {
+        count_rect(index, x, y, w, h, histogram);
+        return (int64_t)w * h;
+    }
+
+    a = corner(index, tx0, ty0);
+    b = corner(index, tx1, ty0);
+    c = corner(index, tx0, ty1);
+    d = corner(index, tx1, ty1);
+    for (k = 0; k < index->bins; k++)
+        histogram[k] = d[k] - b[k] - c[k] + a[k];
+
+    // Edge strips: full-width top and bottom, then left and right of the tile block
+    xa = tile_edge(tx0, index->tile, index->width);
+    xb = tile_edge(tx1, index->tile, index->width);
+    ya = tile_edge(ty0, index->tile, index->height);
+    yb = tile_edge(ty1, index->tile, index->height);
+
+    count_rect(index, x, y, w, ya - y, histogram);
+    count_rect(index, x, yb, w, y + h - yb, histogram);
+    count_rect(index, x, ya, xa - x, yb - ya, histogram);
+    count_rect(index, xb, ya, x + w - xb, yb - ya, histogram);
+
+    return (int64_t)w * h;
+}
+
+void histogram_index_expand(const histogram_index_t *index, const uint32_t *histogram,
+                            uint32_t expanded[256])
+{
+    int i, k, span = 256 / index->bins;
+
+    for (i = 0; i < index->bins; i++) {
+        for (k = 0; k < span; k++)
+            expanded[i * span + k] = histogram[i] / span + (k == 0 ? histogram[i] % span : 0);
+    }
+}
+
+void histogram_index_destroy(histogram_index_t *index)
+{
+    if (index == NULL)
+        return;
+    free(index->luma);
+    free(index->cumulative);
+    free(index);
+}
@@ -0,0 +1,86 @@
+#ifndef HISTOGRAM_ROI_H
+#define HISTOGRAM_ROI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Default index resolution: 32 bins (one per display column)
+ */
+#define HISTOGRAM_INDEX_DEFAULT_BINS 32
+
+/**
+ * @brief Default tile edge in pixels
+ */
+#define HISTOGRAM_INDEX_DEFAULT_TILE 32
+
+/**
+ * @brief Integral-histogram index answering region-of-interest queries
+ */
+typedef struct histogram_index histogram_index_t;
+
+/**
+ * @brief Build the index of an image
+ *
+ * The image is converted to luma once and split into square tiles. For
+ * every tile corner the index stores the cumulative histogram of all
+ * tiles above and to the left of it, so the histogram of any block of
+ * whole tiles is four lookups per bin. The index keeps its own luma
+ * copy; the image can be freed once this returns.
+ *
+ * Memory is (width / tile + 1) * (height / tile + 1) * bins * 4 bytes
+ * plus width * height bytes of luma.
+ *
+ * @param image_data Interleaved pixel data (width * height * channels bytes)
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param channels Bytes per pixel (1 to 4)
+ * @param tile Tile edge in pixels, <= 0 for HISTOGRAM_INDEX_DEFAULT_TILE
+ * @param bins Histogram bins (power of two up to 256), <= 0 for
+ *             HISTOGRAM_INDEX_DEFAULT_BINS
+ * @return Index handle, or NULL on failure
+ */
+histogram_index_t *histogram_index_create(const unsigned char *image_data, int width, int height,
+                                          int channels, int tile, int bins);
+
+/**
+ * @brief Number of bins answered by histogram_index_query()
+ */
+int histogram_index_bins(const histogram_index_t *index);
+
+/**
+ * @brief Histogram of a rectangle of the indexed image
+ *
+ * The tiles fully inside the rectangle are answered from the cumulative
+ * table in O(bins); the partial tiles along the edges (fewer than
+ * 2 * tile * (w + h) pixels) are counted from the luma copy. The result
+ * is exact at the index resolution: bin k counts luma values
+ * [k * 256 / bins, (k + 1) * 256 / bins).
+ *
+ * @param index Index handle
+ * @param x Left column
+ * @param y Top row
+ * @param w Rectangle width (> 0)
+ * @param h Rectangle height (> 0)
+ * @param histogram Output histogram of histogram_index_bins() entries
+ * @return Pixels in the rectangle, or -1 if it's not inside the image
+ */
+int64_t histogram_index_query(const histogram_index_t *index, int x, int y, int w, int h,
+                              uint32_t *histogram);
+
+/**
+ * @brief Spread an index histogram over 256 bins
+ *
+ * Each bin's count is split evenly across its 256 / bins slots (the
+ * remainder goes to the first one), so histogram_dimension() can show
+ * the result like a full-resolution histogram.
+ */
+void histogram_index_expand(const histogram_index_t *index, const uint32_t *histogram,
+                            uint32_t expanded[256]);
+
+/**
+ * @brief Free the index
+ */
+void histogram_index_destroy(histogram_index_t *index);
+
+#endif // HISTOGRAM_ROI_H
@@ -0,0 +1,427 @@
+#define _POSIX_C_SOURCE 200809L
+#include "histogram_sim.h"
+#include "max7219_proto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Same limit as the driver's copy of a text command
+#define SIM_MAX_COMMAND 4096
+
+struct histogram_sim {
+    uint8_t framebuffer[HISTOGRAM_SIM_MAX_MATRICES][HISTOGRAM_SIM_ROWS];
+    uint8_t leds[HISTOGRAM_SIM_MAX_MATRICES][HISTOGRAM_SIM_ROWS];   // digit registers
+    uint8_t shown[HISTOGRAM_SIM_MAX_MATRICES][HISTOGRAM_SIM_ROWS];  // driver's shadow
+    int matrices;           // chain length, like the driver's module parameters
+    int tile_cols;          // matrices per display row
+    int lanes;              // chains shifting in parallel
+    size_t fb_bytes;        // framebuffer bytes in use
+    bool shown_valid;
+    int intensity;
+    bool query_binary;      // a "query" was written
+    bool render;
+    bool sleep;
+    uint64_t spi_hz;
+    histogram_sim_stats_t stats;
+    char command[SIM_MAX_COMMAND + 1];
+};
+
+bool histogram_sim_is_device(const char *device)
+{
+    size_t len = strlen(HISTOGRAM_SIM_PREFIX);
+
+    return device != NULL && strncmp(device, HISTOGRAM_SIM_PREFIX, len) == 0 &&
+           (device[len] == '\0' || device[len] == ':');
+}
+
+static int parse_options(histogram_sim_t *sim, const char *options)
+{
+    char copy[256];
+    char *option, *save;
+    char *end;
+
+    if (strlen(options) >= sizeof(copy)) {
+        fprintf(stderr, "Simulator options too long\n");
+        return -1;
+    }
+    strcpy(copy, options);
+
+    for (option = strtok_r(copy, ",", &save); option != NULL;
+         option = strtok_r(NULL, ",", &save)) {
+        if (strcmp(option, "render") == 0) {
+            sim->render = true;
+        } else if (strcmp(option, "sleep") == 0) {
+            sim->sleep = true;
+        } else if (strncmp(option, "matrices=", 9) == 0) {
+            sim->matrices = (int)strtol(option + 9, &end, 10);
+            if (*end != '\0' || sim->matrices < 1 || sim->matrices > HISTOGRAM_SIM_MAX_MATRICES) {
+                fprintf(stderr, "Invalid simulator chain length: %s\n", option + 9);
+                return -1;
+            }
+        } else if (strncmp(option, "cols=", 5) == 0) {
+            sim->tile_cols = (int)strtol(option + 5, &end, 10);
+            if (*end != '\0' || sim->tile_cols < 1) {
+                fprintf(stderr, "Invalid simulator wall width: %s\n", option + 5);
+                return -1;
+            }
+        } else if (strncmp(option, "lanes=", 6) == 0) {
+            sim->lanes = (int)strtol(option + 6, &end, 10);
+            if (*end != '\0' || sim->lanes < 1 || sim->lanes > HISTOGRAM_SIM_MAX_LANES) {
+                fprintf(stderr, "Invalid simulator lane count: %s\n", option + 6);
+                return -1;
+            }
+        } else if (strncmp(option, "spi=", 4) == 0) {
+            sim->spi_hz = strtoull(option + 4, &end, 10);
+            if (*end != '\0' || sim->spi_hz == 0) {
+                fprintf(stderr, "Invalid simulator SPI clock: %s\n", option + 4);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Unknown simulator option: %s\n", option);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+histogram_sim_t *histogram_sim_create(const char *device)
+{
+    histogram_sim_t *sim;
+    const char *options;
+
+    if (!histogram_sim_is_device(device)) {
+        fprintf(stderr, "Not a simulator device: %s\n", device != NULL ? device : "(null)");
+        return NULL;
+    }
+
+    sim = calloc(1, sizeof(*sim));
+    if (sim == NULL) {
+        perror("Failed to allocate simulator");
+        return NULL;
+    }
+    sim->spi_hz = HISTOGRAM_SIM_DEFAULT_SPI_HZ;
+    sim->intensity = 8;
+    sim->matrices = HISTOGRAM_SIM_MATRICES;
+    sim->lanes = 1;
+
+    options = device + strlen(HISTOGRAM_SIM_PREFIX);
+    if (*options == ':' && parse_options(sim, options + 1) < 0) {
+        free(sim);
+        return NULL;
+    }
+
+    // Same layout checks as the driver's module parameters
+    if (sim->tile_cols == 0) {
+        sim->tile_cols = sim->matrices < HISTOGRAM_SIM_MAX_COLS ? sim->matrices
+                                                                 : HISTOGRAM_SIM_MAX_COLS;
+        while (sim->matrices % sim->tile_cols != 0)
+            sim->tile_cols--;
+    }
+    if (sim->matrices % sim->tile_cols != 0) {
+        fprintf(stderr, "Simulator cols=%d doesn't divide matrices=%d\n",
+                sim->tile_cols, sim->matrices);
+        free(sim);
+        return NULL;
+    }
+    if (sim->tile_cols > HISTOGRAM_SIM_MAX_COLS) {
+        fprintf(stderr, "Simulator cols=%d is over %d: rows wider than 256 columns\n",
+                sim->tile_cols, HISTOGRAM_SIM_MAX_COLS);
+        free(sim);
+        return NULL;
+    }
+    if (sim->matrices % sim->lanes != 0) {
+        fprintf(stderr, "Simulator lanes=%d don't divide matrices=%d\n",
+                sim->lanes, sim->matrices);
+        free(sim);
+        return NULL;
+    }
+    sim->fb_bytes = (size_t)sim->matrices * HISTOGRAM_SIM_ROWS;
+
+    return sim;
+}
+
+void histogram_sim_destroy(histogram_sim_t *sim)
+{
+    free(sim);
+}
+
+// Charge one chained transaction, as max7219_send_chain(): register
+// and data byte for every module, the lanes sharing the clock cycles
+static void spi_transaction(histogram_sim_t *sim)
+{
+    uint64_t bits = (uint64_t)sim->matrices * 16;
+    uint64_t clocks = bits / sim->lanes;
+
+    sim->stats.transactions++;
+    sim->stats.bits += bits;
+    sim->stats.spi_ns += HISTOGRAM_SIM_CS_NS + clocks * 1000000000ull / sim->spi_hz;
+}
+
+static void sim_broadcast_row(histogram_sim_t *sim, int row, uint8_t value)
+{
+    int matrix;
+
+    for (matrix = 0; matrix < sim->matrices; matrix++)
+        sim->leds[matrix][row] = value;
+    spi_transaction(sim);
+}
+
+static void sim_set_pixel(histogram_sim_t *sim, int x, int y, bool on)
+{
+    uint8_t bit;
+
+    if (x < 0 || x >= sim->matrices * 8 || y < 0 || y >= HISTOGRAM_SIM_ROWS)
+        return;
+
+    bit = (uint8_t)(1 << (7 - x % 8));
+    if (on)
+        sim->framebuffer[x / 8][y] |= bit;
+    else
+        sim->framebuffer[x / 8][y] &= (uint8_t)~bit;
+}
+
+// max7219_update(): one chained transaction per changed row
+static void sim_update(histogram_sim_t *sim)
+{
+    bool dirty;
+    int matrix, row;
+
+    for (row = 0; row < HISTOGRAM_SIM_ROWS; row++) {
+        dirty = !sim->shown_valid;
+        for (matrix = 0; matrix < sim->matrices; matrix++) {
+            if (sim->shown[matrix][row] != sim->framebuffer[matrix][row])
+                dirty = true;
+        }
+        if (!dirty)
+            continue;
+
+        for (matrix = 0; matrix < sim->matrices; matrix++) {
+            sim->leds[matrix][row] = sim->framebuffer[matrix][row];
+            sim->shown[matrix][row] = sim->framebuffer[matrix][row];
+        }
+        spi_transaction(sim);
+    }
+    sim->shown_valid = true;
+}
+
+static void sim_clear(histogram_sim_t *sim)
+{
+    int row;
+
+    memset(sim->framebuffer, 0, sim->fb_bytes);
+    for (row = 0; row < HISTOGRAM_SIM_ROWS; row++)
+        sim_broadcast_row(sim, row, 0);
+    memset(sim->shown, 0, sizeof(sim->shown));
+    sim->shown_valid = true;
+}
+
+static int sim_blit(histogram_sim_t *sim, const uint8_t *buf, size_t size)
+{
+    struct max7219_blit_header header;
+    const uint8_t *payload = buf + sizeof(header);
+    uint8_t *rows = (uint8_t *)sim->framebuffer;
+    size_t i;
+
+    if (size < sizeof(header))
+        return -1;
+    memcpy(&header, buf, sizeof(header));
+
+    if (header.matrices != sim->matrices || header.rows != HISTOGRAM_SIM_ROWS ||
+        header.length > 3 * sim->fb_bytes || size != sizeof(header) + header.length)
+        return -1;
+
+    switch (header.opcode) {
+    case MAX7219_OP_FRAME:
+        if (header.length != sim->fb_bytes)
+            return -1;
+        memcpy(sim->framebuffer, payload, sim->fb_bytes);
+        break;
+    case MAX7219_OP_UPDATE:
+        if (header.length % 2 != 0)
+            return -1;
+        for (i = 0; i < header.length; i += 2) {
+            if (payload[i] >= sim->fb_bytes)
+                return -1;
+        }
+        for (i = 0; i < header.length; i += 2)
+            rows[payload[i]] = payload[i + 1];
+        break;
+    case MAX7219_OP_UPDATE_WIDE:
+        if (header.length % 3 != 0)
+            return -1;
+        for (i = 0; i < header.length; i += 3) {
+            if ((size_t)(payload[i] | payload[i + 1] << 8) >= sim->fb_bytes)
+                return -1;
+        }
+        for (i = 0; i < header.length; i += 3)
+            rows[payload[i] | payload[i + 1] << 8] = payload[i + 2];
+        break;
+    default:
+        return -1;
+    }
+
+    if (header.flags & MAX7219_BLIT_FULL)
+        sim->shown_valid = false;
+    sim_update(sim);
+    return 0;
+}
+
+// Text commands, parsed the way proc_write() parses them
+static int sim_command(histogram_sim_t *sim, const char *buf, size_t size)
+{
+    char cmd[32] = "";
+    int width = sim->matrices * 8;
+    int x, y, on, level, row, col;
+
+    if (size > SIM_MAX_COMMAND)
+        size = SIM_MAX_COMMAND;
+    memcpy(sim->command, buf, size);
+    sim->command[size] = '\0';
+
+    sscanf(sim->command, "%31s", cmd);
+
+    if (strcmp(cmd, MAX7219_CMD_QUERY) == 0) {
+        sim->query_binary = true;
+    } else if (strcmp(cmd, "clear") == 0) {
+        sim_clear(sim);
+    } else if (strcmp(cmd, "test") == 0) {
+        // Diagonal through the wall, in the driver's logical coordinates
+        for (x = 0; x < sim->tile_cols * 8; x++) {
+            y = x % (sim->matrices / sim->tile_cols * HISTOGRAM_SIM_ROWS);
+            sim->framebuffer[(y / HISTOGRAM_SIM_ROWS) * sim->tile_cols + x / 8]
+                            [HISTOGRAM_SIM_ROWS - 1 - x % 8] |= (uint8_t)(0x80 >> (y % 8));
+        }
+        sim_update(sim);
+    } else if (strcmp(cmd, "histogram") == 0) {
+        const uint8_t *lengths = (const uint8_t *)sim->command + strlen(cmd) + 1;
+
+        // Only a single row of modules takes the text histogram
+        if (sim->tile_cols != sim->matrices)
+            return -1;
+        if (size < strlen(cmd) + 1 + (size_t)width)
+            return -1;
+
+        memset(sim->framebuffer, 0, sim->fb_bytes);
+        for (row = 0; row < HISTOGRAM_SIM_ROWS; row++) {
+            for (col = 0; col < lengths[row] && col < width; col++)
+                sim_set_pixel(sim, col, row, true);
+        }
+        sim_update(sim);
+    } else if (strcmp(cmd, "pixel") == 0) {
+        if (sscanf(sim->command, "pixel %d %d %d", &x, &y, &on) != 3 ||
+            x < 0 || x >= width || y < 0 || y >= HISTOGRAM_SIM_ROWS)
+            return -1;
+        sim_set_pixel(sim, x, y, on != 0);
+        sim_update(sim);
+    } else if (strcmp(cmd, "intensity") == 0) {
+        if (sscanf(sim->command, "intensity %d", &level) == 1 && level >= 0 && level <= 15) {
+            sim->intensity = level;
+            spi_transaction(sim);
+        }
+    }
+
+    return 0;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec = (time_t)(ns / 1000000000ull),
+        .tv_nsec = (long)(ns % 1000000000ull),
+    };
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+ssize_t histogram_sim_write(histogram_sim_t *sim, const void *buf, size_t size)
+{
+    const uint8_t *bytes = buf;
+    uint64_t spi_ns = sim->stats.spi_ns;
+    uint64_t transactions = sim->stats.transactions;
+    int result;
+
+    if (size > 0 && bytes[0] == MAX7219_BLIT_MAGIC)
+        result = sim_blit(sim, bytes, size);
+    else
+        result = sim_command(sim, buf, size);
+
+    if (result < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    sim->stats.writes++;
+
+    if (sim->sleep)
+        sleep_ns(sim->stats.spi_ns - spi_ns);
+    if (sim->render && sim->stats.transactions != transactions)
+        histogram_sim_render(sim, stderr);
+
+    return (ssize_t)size;
+}
+
+ssize_t histogram_sim_pread(histogram_sim_t *sim, void *buf, size_t count, off_t offset)
+{
+    char text[128];
+    int width = sim->tile_cols * 8;
+    int height = sim->matrices / sim->tile_cols * HISTOGRAM_SIM_ROWS;
+    int len;
+
+    if (offset > 0)
+        return 0;
+
+    if (sim->query_binary) {
+        struct max7219_info info = {
+            .magic = MAX7219_INFO_MAGIC,
+            .version = MAX7219_INFO_VERSION,
+            .size = sizeof(info),
+            .matrices = (uint16_t)sim->matrices,
+            .width = (uint16_t)width,
+            .height = (uint16_t)height,
+        };
+
+        if (count > sizeof(info))
+            count = sizeof(info);
+        memcpy(buf, &info, count);
+        return (ssize_t)count;
+    }
+
+    len = snprintf(text, sizeof(text), "matrices=%d\nwidth=%d\nheight=%d\n",
+                   sim->matrices, width, height);
+    if ((size_t)len > count)
+        len = (int)count;
+    memcpy(buf, text, len);
+    return len;
+}
+
+const uint8_t *histogram_sim_framebuffer(const histogram_sim_t *sim)
+{
+    return &sim->framebuffer[0][0];
+}
+
+void histogram_sim_render(const histogram_sim_t *sim, FILE *out)
+{
+    char line[HISTOGRAM_SIM_MAX_MATRICES * 8 + 2];
+    int width = sim->tile_cols * 8;
+    int first, row, x;
+
+    // Modules sit where the wall layout puts them, each drawn as its
+    // digit registers
+    for (first = 0; first < sim->matrices; first += sim->tile_cols) {
+        for (row = 0; row < HISTOGRAM_SIM_ROWS; row++) {
+            for (x = 0; x < width; x++)
+                line[x] = (sim->leds[first + x / 8][row] & (0x80 >> (x % 8))) ? '#' : '.';
+            line[width] = '\n';
+            line[width + 1] = '\0';
+            fputs(line, out);
+        }
+    }
+    fputc('\n', out);
+}
+
+void histogram_sim_get_stats(const histogram_sim_t *sim, histogram_sim_stats_t *stats)
+{
+    *stats = sim->stats;
+}
@@ -0,0 +1,131 @@
+#ifndef HISTOGRAM_SIM_H
+#define HISTOGRAM_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * @brief Environment variable naming the display device
+ *
+ * Used by histogram_init() and histogram_ctx_open(NULL) instead of
+ * /proc/max7219 when set. A value starting with HISTOGRAM_SIM_PREFIX
+ * selects the in-process simulator, e.g.
+ *
+ *     HISTOGRAM_DEVICE=sim:render,spi=1000000 ./histogram image.jpg
+ */
+#define HISTOGRAM_DEVICE_ENV "HISTOGRAM_DEVICE"
+
+/**
+ * @brief Device name prefix selecting the simulator
+ *
+ * Options follow a colon, separated by commas:
+ *   - render:      print the display as ASCII to stderr after every flush
+ *   - sleep:       make each write take its modeled SPI time
+ *   - spi=HZ:      SPI clock used by the timing model
+ *   - matrices=N:  chain length, 1 to HISTOGRAM_SIM_MAX_MATRICES
+ *   - cols=C:      matrices per display row, dividing N, at most
+ *                  HISTOGRAM_SIM_MAX_COLS (default the most that fit)
+ *   - lanes=L:     chains shifting in parallel, dividing N (default 1)
+ */
+#define HISTOGRAM_SIM_PREFIX "sim"
+
+/**
+ * @brief Simulated geometry, the same defaults and limit as the driver's
+ */
+#define HISTOGRAM_SIM_MATRICES     4
+#define HISTOGRAM_SIM_MAX_MATRICES 64
+#define HISTOGRAM_SIM_ROWS         8
+#define HISTOGRAM_SIM_MAX_LANES    8
+#define HISTOGRAM_SIM_MAX_COLS     32  // 256 columns, the widest histogram_lib draws
+
+/**
+ * @brief Default SPI clock of the timing model
+ *
+ * The driver bit-bangs with two udelay(5) per bit, about 100 kHz.
+ */
+#define HISTOGRAM_SIM_DEFAULT_SPI_HZ 100000
+
+/**
+ * @brief Chip-select overhead of one transaction in the timing model
+ *
+ * The driver waits 5 us after asserting CS, before releasing it and
+ * after releasing it.
+ */
+#define HISTOGRAM_SIM_CS_NS 15000
+
+/**
+ * @brief In-process emulation of the MAX7219 driver
+ *
+ * Accepts the same writes as /proc/max7219 (text commands, the binary
+ * query and binary blits) with the same validation and errors, keeps the
+ * matrices x 8 framebuffer and the set of registers last clocked out, and
+ * charges every transaction the SPI time the driver would spend on it.
+ * One simulator stands for one open file of the driver.
+ */
+typedef struct histogram_sim histogram_sim_t;
+
+/**
+ * @brief Counters of a simulator
+ */
+typedef struct {
+    uint64_t writes;        /**< write() calls accepted */
+    uint64_t transactions;  /**< SPI transactions (CS frames) */
+    uint64_t bits;          /**< Bits clocked out */
+    uint64_t spi_ns;        /**< Modeled SPI time of all transactions */
+} histogram_sim_stats_t;
+
+/**
+ * @brief Check whether a device name selects the simulator
+ */
+bool histogram_sim_is_device(const char *device);
+
+/**
+ * @brief Create a simulator from a device name
+ * @param device HISTOGRAM_SIM_PREFIX, optionally followed by ":options"
+ * @return Simulator, or NULL on failure (including unknown options)
+ */
+histogram_sim_t *histogram_sim_create(const char *device);
+
+/**
+ * @brief Free a simulator
+ */
+void histogram_sim_destroy(histogram_sim_t *sim);
+
+/**
+ * @brief Handle one write() to the simulated driver
+ * @return @p size on success, -1 with errno set like the driver's error
+ */
+ssize_t histogram_sim_write(histogram_sim_t *sim, const void *buf, size_t size);
+
+/**
+ * @brief Handle one pread() from the simulated driver
+ *
+ * Returns struct max7219_info after a "query" write, the text geometry
+ * otherwise, and 0 bytes past offset 0.
+ */
+ssize_t histogram_sim_pread(histogram_sim_t *sim, void *buf, size_t count, off_t offset);
+
+/**
+ * @brief Framebuffer of the simulated driver
+ * @return matrices * HISTOGRAM_SIM_ROWS bytes in the driver's
+ *         framebuffer[matrix][row] order
+ */
+const uint8_t *histogram_sim_framebuffer(const histogram_sim_t *sim);
+
+/**
+ * @brief Print the LEDs as the modules show them, '#' for lit
+ *
+ * Only registers that were clocked out are shown, so a framebuffer
+ * change the driver never flushes doesn't appear.
+ */
+void histogram_sim_render(const histogram_sim_t *sim, FILE *out);
+
+/**
+ * @brief Read the simulator counters
+ */
+void histogram_sim_get_stats(const histogram_sim_t *sim, histogram_sim_stats_t *stats);
+
+#endif // HISTOGRAM_SIM_H
@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+#include "histogram_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define Y4M_MAGIC "YUV4MPEG2"
+#define Y4M_FRAME "FRAME"
+#define Y4M_LINE_MAX 256
+
+struct frame_stream {
+    FILE *file;
+    frame_format_t format;
+    int width;
+    int height;
+    int channels;
+    size_t frame_bytes;     // bytes kept per frame
+    size_t skip_bytes;      // bytes discarded after each frame (Y4M chroma)
+    uint8_t *buffer;        // reused for every frame
+    uint8_t *discard;       // reused scratch for skipped bytes
+    size_t discard_size;
+};
+
+// Read one '\n'-terminated header line (without the newline)
+static int read_line(FILE *file, char *line, size_t size)
+{
+    size_t len = 0;
+    int c;
+
+    while ((c = fgetc(file)) != EOF && c != '\n') {
+        if (len + 1 >= size)
+            return -1;
+        line[len++] = (char)c;
+    }
+    line[len] = '\0';
+
+    if (c == EOF)
+        return len == 0 ? 0 : -1;
+    return 1;
+}
+
+// Chroma bytes that follow the Y plane for a Y4M colorspace tag
+static int y4m_chroma_bytes(const char *tag, int width, int height, size_t *bytes)
+{
+    size_t cw = (size_t)(width + 1) / 2;
+    size_t ch = (size_t)(height + 1) / 2;
+
+    // 8-bit 4:2:0 siting variants only: C420p10 and the like have 16-bit samples
+    if (strcmp(tag, "420") == 0 || strcmp(tag, "420jpeg") == 0 ||
+        strcmp(tag, "420paldv") == 0 || strcmp(tag, "420mpeg2") == 0) {
+        *bytes = 2 * cw * ch;
+    } else if (strcmp(tag, "422") == 0) {
+        *bytes = 2 * cw * (size_t)height;
+    } else if (strcmp(tag, "444") == 0) {
+        *bytes = 2 * (size_t)width * height;
+    } else if (strcmp(tag, "mono") == 0) {
+        *bytes = 0;
+    } else {
+        fprintf(stderr, "Unsupported Y4M colorspace: C%s\n", tag);
+        return -1;
+    }
+    return 0;
+}
+
+static int y4m_parse_header(frame_stream_t *stream)
+{
+    char line[Y4M_LINE_MAX];
+    char tag[16] = "420jpeg";
+    char *token, *save;
+
+    if (read_line(stream->file, line, sizeof(line)) != 1 ||
+        strncmp(line, Y4M_MAGIC, strlen(Y4M_MAGIC)) != 0) {
+        fprintf(stderr, "Not a YUV4MPEG2 stream\n");
+        return -1;
+    }
+
+    stream->width = 0;
+    stream->height = 0;
+    for (token = strtok_r(line + strlen(Y4M_MAGIC), " ", &save); token != NULL;
+         token = strtok_r(NULL, " ", &save)) {
+        if (token[0] == 'W')
+            stream->width = atoi(token + 1);
+        else if (token[0] == 'H')
+            stream->height = atoi(token + 1);
+        else if (token[0] == 'C')
+            snprintf(tag, sizeof(tag), "%s", token + 1);
+    }
+
+    if (stream->width <= 0 || stream->height <= 0) {
+        fprintf(stderr, "Invalid Y4M geometry: %dx%d\n", stream->width, stream->height);
+        return -1;
+    }
+
+    return y4m_chroma_bytes(tag, stream->width, stream->height, &stream->skip_bytes);
+}
+
+frame_stream_t *frame_stream_open(const char *path, frame_format_t format,
+                                  int width, int height)
+{
+    frame_stream_t *stream;
+
+    if (path == NULL) {
+        fprintf(stderr, "Invalid stream path\n");
+        return NULL;
+    }
+
+    stream = calloc(1, sizeof(*stream));
+    if (stream == NULL) {
+        perror("Failed to allocate frame stream");
+        return NULL;
+    }
+
+    stream->format = format;
+    stream->file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (stream->file == NULL) {
+        perror("Failed to open frame stream");
+        free(stream);
+        return NULL;
+    }
+
+    if (format == FRAME_FORMAT_Y4M) {
+        if (y4m_parse_header(stream) < 0) {
+            frame_stream_close(stream);
+            return NULL;
+        }
+        stream->channels = 1;
+    } else {
+        if (width <= 0 || height <= 0) {
+            fprintf(stderr, "Raw frames need a size, got %dx%d\n", width, height);
+            frame_stream_close(stream);
+            return NULL;
+        }
+        stream->width = width;
+        stream->height = height;
+        stream->channels = format == FRAME_FORMAT_RGB ? 3 : 1;
+    }
+
+    stream->frame_bytes = (size_t)stream->width * stream->height * stream->channels;
+    stream->buffer = malloc(stream->frame_bytes);
+    stream->discard_size = stream->skip_bytes < 65536 ? stream->skip_bytes : 65536;
+    stream->discard = stream->discard_size > 0 ? malloc(stream->discard_size) : NULL;
+    if (stream->buffer == NULL || (stream->discard_size > 0 && stream->discard == NULL)) {
+        perror("Failed to allocate frame buffer");
+        frame_stream_close(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+int frame_stream_read(frame_stream_t *stream, const uint8_t **pixels)
+{
+    size_t got, left;
+
+    if (stream == NULL || pixels == NULL)
+        return -1;
+
+    if (stream->format == FRAME_FORMAT_Y4M) {
+        char line[Y4M_LINE_MAX];
+        int rc = read_line(stream->file, line, sizeof(line));
+
+        if (rc <= 0)
+            return rc;
+        if (strncmp(line, Y4M_FRAME, strlen(Y4M_FRAME)) != 0) {
+            fprintf(stderr, "Corrupt Y4M stream: expected FRAME header\n");
+            return -1;
+        }
+    }
+
+    got = fread(stream->buffer, 1, stream->frame_bytes, stream->file);
+    if (got == 0 && feof(stream->file))
+        return 0;
+    if (got != stream->frame_bytes) {
+        fprintf(stderr, "Truncated frame: %zu of %zu bytes\n", got, stream->frame_bytes);
+        return -1;
+    }
+
+    // Chroma planes are not needed for a luma histogram
+    for (left = stream->skip_bytes; left > 0; left -= got) {
+        size_t chunk = left < stream->discard_size ? left : stream->discard_size;
+        got = fread(stream->discard, 1, chunk, stream->file);
+        if (got != chunk) {
+            fprintf(stderr, "Truncated frame chroma\n");
+            return -1;
+        }
+    }
+
+    *pixels = stream->buffer;
+    return 1;
+}
+
+int frame_stream_width(const frame_stream_t *stream)
+{
+    return stream ? stream->width : 0;
+}
+
+int frame_stream_height(const frame_stream_t *stream)
+{
+    return stream ? stream->height : 0;
+}
+
+int frame_stream_channels(const frame_stream_t *stream)
+{
+    return stream ? stream->channels : 0;
+}
+
+void frame_stream_close(frame_stream_t *stream)
+{
+    if (stream == NULL)
+        return;
+    if (stream->file != NULL && stream->file != stdin)
+        fclose(stream->file);
+    free(stream->buffer);
+    free(stream->discard);
+    free(stream);
+}
@@ -0,0 +1,57 @@
+#ifndef HISTOGRAM_STREAM_H
+#define HISTOGRAM_STREAM_H
+
+#include <stdint.h>
+
+/**
+ * @brief Supported frame stream formats
+ */
+typedef enum {
+    FRAME_FORMAT_GRAY = 0,  /**< Raw 8-bit gray frames, width * height bytes each */
+    FRAME_FORMAT_RGB,       /**< Raw packed RGB24 frames, width * height * 3 bytes each */
+    FRAME_FORMAT_Y4M        /**< YUV4MPEG2; only the Y plane is kept */
+} frame_format_t;
+
+/**
+ * @brief Sequential reader for a stream of video frames
+ */
+typedef struct frame_stream frame_stream_t;
+
+/**
+ * @brief Open a frame stream
+ *
+ * For raw formats the geometry must be given; for Y4M it is read from the
+ * stream header and @p width / @p height are ignored. One frame buffer is
+ * allocated here and reused for every frame.
+ *
+ * @param path File path, or "-" for stdin (e.g. piped from ffmpeg)
+ * @param format Stream format
+ * @param width Frame width for raw formats
+ * @param height Frame height for raw formats
+ * @return Stream handle, or NULL on failure
+ */
+frame_stream_t *frame_stream_open(const char *path, frame_format_t format,
+                                  int width, int height);
+
+/**
+ * @brief Read the next frame into the stream's buffer
+ *
+ * @param stream Stream handle
+ * @param pixels Set to the frame pixels; valid until the next read
+ * @return 1 if a frame was read, 0 at end of stream, -1 on error
+ */
+int frame_stream_read(frame_stream_t *stream, const uint8_t **pixels);
+
+/**
+ * @brief Frame geometry of an open stream
+ */
+int frame_stream_width(const frame_stream_t *stream);
+int frame_stream_height(const frame_stream_t *stream);
+int frame_stream_channels(const frame_stream_t *stream);
+
+/**
+ * @brief Close the stream and free its buffers
+ */
+void frame_stream_close(frame_stream_t *stream);
+
+#endif // HISTOGRAM_STREAM_H
@@ -14,6 +14,7 @@ extern "C"
 #define HISTO_DEFAULT_DEVICE "/dev/histodrv"
 
     typedef struct HistoContext HistoContext;
+    struct histo_page;
     typedef enum
     {
         HISTO_OK = 0,
@@ -64,12 +65,28 @@ extern "C"
     // Escribe el histograma al hardware
     histo_status_t histo_display_bins(HistoContext *ctx, const uint32_t *bins, size_t count);
 
-    histo_status_t histo_led_on(HistoContext *ctx, uint8_t index);
-    histo_status_t histo_led_off(HistoContext *ctx, uint8_t index);
+    histo_status_t histo_led_on(HistoContext *ctx, int index);
+    histo_status_t histo_led_off(HistoContext *ctx, int index);
     histo_status_t histo_clear(HistoContext *ctx);
 
     histo_status_t histo_read_status(HistoContext *ctx, uint32_t *out_flags);
 
+    // Mapea la pagina compartida del framebuffer (ver histo_ioctl.h); se
+    // desmapea en histo_close
+    histo_status_t histo_map_page(HistoContext *ctx, struct histo_page **out);
+
+    // Abren y cierran un frame en la pagina mapeada: begin deja generation
+    // impar, end la deja par. Son la unica forma soportada de cambiar
+    // generation; usan barreras release para que el driver nunca vea el
+    // generation par antes que los bytes del frame (en ARM los stores
+    // normales se pueden reordenar). HISTO_ERR_STATE sin pagina mapeada o
+    // con begin/end fuera de orden
+    histo_status_t histo_page_begin(HistoContext *ctx);
+    histo_status_t histo_page_end(HistoContext *ctx);
+
+    // Pide al driver mostrar ya el ultimo frame completo de la pagina
+    histo_status_t histo_flush(HistoContext *ctx);
+
     // accede a metricas
     void histo_get_metrics(const HistoContext *ctx, histo_metrics_t *out);
 
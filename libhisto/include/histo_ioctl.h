@@ -2,10 +2,17 @@
 #define HISTO_IOCTL_H
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define HISTO_IOC_MAGIC 'H'
 
+// Numero de bins que lee HISTO_IOC_BINS
+#define HISTO_IOC_BINS_COUNT 256
+
 // Encender/apagar LED por indice
+// indice = y * ancho + x, con (0, 0) arriba a la izquierda del display;
+// el ancho y el alto salen de /proc/max7219 o de la pagina compartida
+// (32x8 con la configuracion por defecto del driver)
 #define HISTO_IOC_LED_ON _IOW(HISTO_IOC_MAGIC, 0x01, int)
 #define HISTO_IOC_LED_OFF _IOW(HISTO_IOC_MAGIC, 0x02, int)
 
@@ -13,10 +20,57 @@
 #define HISTO_IOC_CLEAR _IO(HISTO_IOC_MAGIC, 0x03)
 
 // Escribe histograma
-// Espera un puntero a buffer
+// Espera un puntero a HISTO_IOC_BINS_COUNT bins uint32_t; el driver
+// los dimensiona (aritmetica entera) y dibuja una barra por columna,
+// de abajo hacia arriba sobre todas las filas de modulos
 #define HISTO_IOC_BINS _IOW(HISTO_IOC_MAGIC, 0x10, void *)
 
 // Lee estado del dispositivo
 #define HISTO_IOC_STATUS _IOR(HISTO_IOC_MAGIC, 0x20, unsigned int)
 
+// Bits de HISTO_IOC_STATUS
+#define HISTO_STATUS_READY 0x1         // driver cargado y display inicializado
+#define HISTO_STATUS_FLUSH_PENDING 0x2 // hay cambios aun no enviados al display
+#define HISTO_STATUS_BLANK 0x4         // todos los LEDs apagados
+
+// Pide un flush de la pagina compartida sin esperar al sondeo del driver
+#define HISTO_IOC_FLUSH _IO(HISTO_IOC_MAGIC, 0x30)
+
+// Pagina compartida: mmap(NULL, HISTO_PAGE_SIZE, PROT_READ | PROT_WRITE,
+// MAP_SHARED, fd, 0) sobre /dev/histodrv; MAP_PRIVATE o PROT_EXEC dan
+// EINVAL. Se dibuja directo en el framebuffer de la pagina, sin
+// copy_from_user por frame.
+//
+// Protocolo (generation funciona como seqcount):
+//   1. histo_page_begin()  (generation impar: dibujando)
+//   2. escribir bytes de framebuffer y marcar sus bits en dirty
+//   3. histo_page_end()    (generation par: frame completo)
+//   4. HISTO_IOC_FLUSH, o esperar: mientras la pagina este mapeada el
+//      driver revisa generation en cada intervalo de refresco
+// El driver copia la pagina solo con generation par y sin cambios
+// durante la copia, asi nunca muestra un frame a medias. Los bytes con
+// su bit en dirty pertenecen a la pagina y se toman en cada flush; el
+// resto del framebuffer sigue siendo de /proc/max7219 y los ioctl.
+// No incrementar generation a mano: sin las barreras release de
+// histo_page_begin/end un ARM puede publicar el generation par antes que
+// los bytes, y el driver mostraria un frame a medias.
+#define HISTO_PAGE_SIZE 4096
+#define HISTO_PAGE_MAGIC 0x50373248u  // "H27P"
+#define HISTO_PAGE_MAX_BYTES 512
+
+struct histo_page
+{
+    __u32 magic;      // HISTO_PAGE_MAGIC (driver)
+    __u32 generation; // seqcount del frame (usuario)
+    __u32 flushed;    // ultimo generation mostrado (driver)
+    __u16 matrices;   // geometria (driver)
+    __u16 rows;
+    __u32 dirty[HISTO_PAGE_MAX_BYTES / 32]; // bit i: byte i del framebuffer es de la pagina
+    __u16 width;      // display en pixeles: width / 8 modulos por fila,
+    __u16 height;     // height / 8 filas de modulos en orden de cadena
+    __u32 reserved[11];
+    // Orden framebuffer[matriz][fila], bit 7 = LED de la izquierda
+    __u8 framebuffer[HISTO_PAGE_MAX_BYTES];
+};
+
 #endif // HISTO_IOCTL_H
\ No newline at end of file
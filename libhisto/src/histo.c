@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
 struct HistoContext
 {
@@ -18,6 +19,7 @@ struct HistoContext
     int simulator; // 0 = real, 1 = simulado
     int collect_metrics;
     histo_metrics_t m;
+    struct histo_page *page; // pagina compartida, NULL si no esta mapeada
 };
 
 // Obtiene el tiempo actual en microsegundos
@@ -123,6 +125,14 @@ void histo_close(HistoContext *ctx)
 {
     if (!ctx)
         return;
+    if (ctx->page)
+    {
+        if (ctx->simulator)
+            free(ctx->page);
+        else
+            munmap(ctx->page, HISTO_PAGE_SIZE);
+        ctx->page = NULL;
+    }
     if (!ctx->simulator && ctx->fd != -1)
     {
         close(ctx->fd);
@@ -162,16 +172,14 @@ static histo_status_t do_ioctl(HistoContext *ctx, unsigned long req, void *arg)
     return (rc == 0) ? HISTO_OK : HISTO_ERR_IOCTL;
 }
 
-histo_status_t histo_led_on(HistoContext *ctx, uint8_t index)
+histo_status_t histo_led_on(HistoContext *ctx, int index)
 {
-    int idx = (int)index;
-    return do_ioctl(ctx, HISTO_IOC_LED_ON, &idx);
+    return do_ioctl(ctx, HISTO_IOC_LED_ON, &index);
 }
 
-histo_status_t histo_led_off(HistoContext *ctx, uint8_t index)
+histo_status_t histo_led_off(HistoContext *ctx, int index)
 {
-    int idx = (int)index;
-    return do_ioctl(ctx, HISTO_IOC_LED_OFF, &idx);
+    return do_ioctl(ctx, HISTO_IOC_LED_OFF, &index);
 }
 
 histo_status_t histo_clear(HistoContext *ctx)
@@ -193,11 +201,18 @@ histo_status_t histo_display_bins(HistoContext *ctx, const uint32_t *bins, size_
         // Simulacion validar entrada
         rc = 0;
     }
-    else
+    else if (count == HISTO_IOC_BINS_COUNT)
     {
         // El driver espera el puntero de usuario
         rc = ioctl(ctx->fd, HISTO_IOC_BINS, (void *)bins);
     }
+    else
+    {
+        // El driver siempre lee HISTO_IOC_BINS_COUNT bins: rellenar con ceros
+        uint32_t padded[HISTO_IOC_BINS_COUNT] = {0};
+        memcpy(padded, bins, count * sizeof(*bins));
+        rc = ioctl(ctx->fd, HISTO_IOC_BINS, padded);
+    }
 
     if (ctx->collect_metrics)
     {
@@ -242,4 +257,86 @@ void histo_get_metrics(const HistoContext *ctx, histo_metrics_t *out)
     if (!ctx || !out)
         return;
     *out = ctx->m;
-}
\ No newline at end of file
+}
+
+histo_status_t histo_map_page(HistoContext *ctx, struct histo_page **out)
+{
+    if (!ctx || !out)
+        return HISTO_ERR_ARG;
+    if (ctx->page)
+    {
+        *out = ctx->page;
+        return HISTO_OK;
+    }
+
+    if (ctx->simulator)
+    {
+        // Simulacion: pagina en memoria con la geometria por defecto
+        ctx->page = (struct histo_page *)calloc(1, HISTO_PAGE_SIZE);
+        if (!ctx->page)
+            return HISTO_ERR_NOMEM;
+        ctx->page->magic = HISTO_PAGE_MAGIC;
+        ctx->page->matrices = 4;
+        ctx->page->rows = 8;
+        ctx->page->width = 32;
+        ctx->page->height = 8;
+    }
+    else
+    {
+        if (ctx->fd == -1)
+            return HISTO_ERR_STATE;
+        void *map = mmap(NULL, HISTO_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd, 0);
+        if (map == MAP_FAILED)
+        {
+            perror("mmap device");
+            return HISTO_ERR_OPEN;
+        }
+        ctx->page = (struct histo_page *)map;
+        if (ctx->page->magic != HISTO_PAGE_MAGIC)
+        {
+            munmap(map, HISTO_PAGE_SIZE);
+            ctx->page = NULL;
+            return HISTO_ERR_STATE;
+        }
+    }
+
+    *out = ctx->page;
+    return HISTO_OK;
+}
+
+histo_status_t histo_page_begin(HistoContext *ctx)
+{
+    uint32_t gen;
+
+    if (!ctx || !ctx->page)
+        return HISTO_ERR_STATE;
+    gen = __atomic_load_n(&ctx->page->generation, __ATOMIC_RELAXED);
+    if (gen & 1)
+        return HISTO_ERR_STATE;
+
+    // Impar antes que cualquier byte del frame (smp_wmb de un seqcount)
+    __atomic_store_n(&ctx->page->generation, gen + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return HISTO_OK;
+}
+
+histo_status_t histo_page_end(HistoContext *ctx)
+{
+    uint32_t gen;
+
+    if (!ctx || !ctx->page)
+        return HISTO_ERR_STATE;
+    gen = __atomic_load_n(&ctx->page->generation, __ATOMIC_RELAXED);
+    if (!(gen & 1))
+        return HISTO_ERR_STATE;
+
+    // Los bytes y el dirty del frame antes que el generation par
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->page->generation, gen + 1, __ATOMIC_RELEASE);
+    return HISTO_OK;
+}
+
+histo_status_t histo_flush(HistoContext *ctx)
+{
+    return do_ioctl(ctx, HISTO_IOC_FLUSH, NULL);
+}
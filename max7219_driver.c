@@ -5,12 +5,26 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <asm/io.h>
+#include <asm/barrier.h>
+#include <linux/atomic.h>
 #include <linux/delay.h>
+#include <linux/fs.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+#include "max7219_proto.h"
+#include "max7219_spi.h"
+#include "histo_ioctl.h"    // libhisto/include, added by the Makefile
 
 #define MAX_USER_SIZE 4096
 #define BCM2837_GPIO_ADDRESS 0x3F200000
 
-// SPI Pins
+// SPI Pins; SPI_MOSI is the default single lane
 #define SPI_MOSI  10
 #define SPI_CLK   11
 #define SPI_CS    8
@@ -31,110 +45,131 @@
 #define MAX7219_REG_SHUTDOWN    0x0C
 #define MAX7219_REG_DISPLAYTEST 0x0F
 
-#define NUM_MATRICES 4
 #define MATRIX_HEIGHT 8
+#define MAX_MATRICES 64     // framebuffer fits HISTO_PAGE_MAX_BYTES
+#define MAX_TILE_COLS 32    // 256 columns: one per bin, as histogram_lib allows
+
+// file->private_data value of files that asked for binary query replies
+#define QUERY_BINARY ((void *)1)
 
 static struct proc_dir_entry *proc_entry = NULL;
 static char data_buffer[MAX_USER_SIZE];
 static unsigned int *gpio_registers = NULL;
 
-static uint8_t framebuffer[NUM_MATRICES][MATRIX_HEIGHT];
+// Chain length and wall layout: tile_cols modules per display row,
+// rows filled in chain order from the top left
+static unsigned int matrices = 4;
+module_param(matrices, uint, 0444);
+MODULE_PARM_DESC(matrices, "Matrices in the daisy chain, 1-64 (default 4)");
 
-static inline void gpio_set_output(unsigned int pin)
-{
-    unsigned int reg = pin / 10;
-    unsigned int shift = (pin % 10) * 3;
-    unsigned int *fsel = gpio_registers + reg;
-    
-    *fsel &= ~(7 << shift);  // Clear
-    *fsel |= (1 << shift);   // Set as output (001)
-}
+static unsigned int tile_cols = 0;
+module_param(tile_cols, uint, 0444);
+MODULE_PARM_DESC(tile_cols, "Matrices per display row, 1-32 dividing matrices "
+                 "(default the most up to 32 that divide matrices)");
 
-static inline void gpio_set_high(unsigned int pin)
-{
-    unsigned int *set_reg = (unsigned int*)((char*)gpio_registers + 0x1C);
-    *set_reg = (1 << pin);
-}
+static unsigned int tile_rows;
+static size_t fb_bytes;     // matrices * MATRIX_HEIGHT
 
-static inline void gpio_set_low(unsigned int pin)
-{
-    unsigned int *clr_reg = (unsigned int*)((char*)gpio_registers + 0x28);
-    *clr_reg = (1 << pin);
-}
+// framebuffer[matrix][row], allocated for the chain at load time
+static uint8_t (*framebuffer)[MATRIX_HEIGHT] = NULL;
+
+// Digit registers as last clocked out; only valid after a full update.
+// Owned by the flush worker once the module is loaded, like flush_rows,
+// its snapshot of the framebuffer.
+static uint8_t (*shown)[MATRIX_HEIGHT] = NULL;
+static uint8_t (*flush_rows)[MATRIX_HEIGHT] = NULL;
+static bool shown_valid = false;
+
+// Blit payload and shared page copy, used under fb_lock
+static uint8_t *blit_payload = NULL;    // 3 * fb_bytes: the largest blit
+static uint8_t *page_bytes = NULL;      // fb_bytes
+
+// Writers only change the framebuffer; the SPI flush runs in a worker,
+// at most once per refresh interval
+static unsigned int refresh_ms = 20;
 
-static void spi_init(void)
+// refresh_ms can be changed at runtime; 0 would make the page poll spin
+static int refresh_ms_set(const char *val, const struct kernel_param *kp)
 {
-    gpio_set_output(SPI_MOSI);
-    gpio_set_output(SPI_CLK);
-    gpio_set_output(SPI_CS);
+    unsigned int ms;
+    int ret;
     
-    gpio_set_low(SPI_MOSI);
-    gpio_set_low(SPI_CLK);
-    gpio_set_high(SPI_CS);
+    ret = kstrtouint(val, 0, &ms);
+    if (ret)
+        return ret;
+    if (ms < 1)
+        return -EINVAL;
+    
+    WRITE_ONCE(refresh_ms, ms);
+    return 0;
 }
 
-static void spi_transfer_byte(uint8_t data)
-{
-    int i;
-    for (i = 7; i >= 0; i--) {
-        gpio_set_low(SPI_CLK);
-        
-        if (data & (1 << i))
-            gpio_set_high(SPI_MOSI);
-        else
-            gpio_set_low(SPI_MOSI);
-        
-        udelay(5);
-        gpio_set_high(SPI_CLK);
-        udelay(5);
-    }
-    gpio_set_low(SPI_CLK);
-}
+static const struct kernel_param_ops refresh_ms_ops = {
+    .set = refresh_ms_set,
+    .get = param_get_uint,
+};
+module_param_cb(refresh_ms, &refresh_ms_ops, &refresh_ms, 0644);
+MODULE_PARM_DESC(refresh_ms, "Minimum time between display flushes in ms, at least 1 (default 20)");
+
+static void max7219_flush_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(flush_work, max7219_flush_work);
+
+// Guards the framebuffer, data_buffer and the pending flush state below
+static DEFINE_MUTEX(fb_lock);
+static bool flush_full = false;         // reclock every row on the next flush
+static int pending_intensity = -1;      // intensity to send, -1 if none
+static unsigned long last_flush;        // jiffies at the start of the last flush
 
-static void max7219_send(uint8_t reg, uint8_t data, int matrix_index)
+// Framebuffer page shared with userspace through mmap of /dev/histodrv
+static struct histo_page *shared_page = NULL;
+static atomic_t page_maps = ATOMIC_INIT(0);    // live mappings: poll the page
+static u32 page_generation = 0;                // last generation taken
+
+// One MOSI pin per chain; the chains share CLK and CS and each drives
+// matrices / lanes consecutive matrices of the display
+static unsigned int mosi_pins[MAX7219_SPI_MAX_LANES] = { SPI_MOSI };
+static int lanes = 1;
+module_param_array(mosi_pins, uint, &lanes, 0444);
+MODULE_PARM_DESC(mosi_pins, "MOSI GPIO of each chain, up to 8 (default 10)");
+
+static struct max7219_spi spi;
+static unsigned int lane_matrices;      // matrices / lanes
+
+// One CS frame through the daisy chains: register reg of every matrix
+// gets its own data byte. The lanes shift in parallel, lane l carrying
+// matrices l * lane_matrices onwards; the first bytes shifted in end up
+// in the last matrix of each lane.
+static void max7219_send_chain(uint8_t reg, const uint8_t *data)
 {
-    int i;
+    uint8_t regs[MAX7219_SPI_MAX_LANES], bytes[MAX7219_SPI_MAX_LANES];
+    int lane, i;
     
-    gpio_set_low(SPI_CS);
-    udelay(5);
+    memset(regs, reg, sizeof(regs));
+    max7219_spi_select(&spi);
     
-    for (i = NUM_MATRICES - 1; i >= 0; i--) {
-        if (i == matrix_index) {
-            spi_transfer_byte(reg);
-            spi_transfer_byte(data);
-        } else {
-            // Send NOOP to other matrices
-            spi_transfer_byte(MAX7219_REG_NOOP);
-            spi_transfer_byte(0x00);
-        }
+    for (i = lane_matrices - 1; i >= 0; i--) {
+        for (lane = 0; lane < lanes; lane++)
+            bytes[lane] = data[lane * lane_matrices + i];
+        max7219_spi_shift(&spi, regs);
+        max7219_spi_shift(&spi, bytes);
     }
     
-    udelay(5);
-    gpio_set_high(SPI_CS);
-    udelay(5);
+    max7219_spi_deselect(&spi);
 }
 
 static void max7219_broadcast(uint8_t reg, uint8_t data)
 {
-    int i;
-    
-    gpio_set_low(SPI_CS);
-    udelay(5);
+    uint8_t all[MAX_MATRICES];
     
     // Mismo comando a todas las matrices
-    for (i = 0; i < NUM_MATRICES; i++) {
-        spi_transfer_byte(reg);
-        spi_transfer_byte(data);
-    }
-    
-    udelay(5);
-    gpio_set_high(SPI_CS);
-    udelay(5);
+    memset(all, data, matrices);
+    max7219_send_chain(reg, all);
 }
 
 static void max7219_init(void)
 {
-    spi_init();
+    max7219_spi_init(&spi, (volatile uint32_t *)gpio_registers, SPI_CLK, SPI_CS,
+                     mosi_pins, lanes);
     
     // Initialize all matrices
     max7219_broadcast(MAX7219_REG_SHUTDOWN, 0x00);      // Shutdown mode
@@ -145,38 +180,143 @@ static void max7219_init(void)
     max7219_broadcast(MAX7219_REG_SHUTDOWN, 0x01);      // Normal operation
     
     // Clear all matrices
-    memset(framebuffer, 0, sizeof(framebuffer));
+    memset(framebuffer, 0, fb_bytes);
 }
 
 static void max7219_clear(void)
 {
     int row;
     
-    memset(framebuffer, 0, sizeof(framebuffer));
+    memset(framebuffer, 0, fb_bytes);
     
     for (row = 0; row < MATRIX_HEIGHT; row++) {
         max7219_broadcast(MAX7219_REG_DIGIT0 + row, 0x00);
     }
+    
+    memset(shown, 0, fb_bytes);
+    shown_valid = true;
 }
 
-static void max7219_update(void)
+// Clock out the rows of a framebuffer snapshot that changed, each to
+// every matrix in one CS frame: at most MATRIX_HEIGHT frames of
+// 16 * matrices bits, whatever the chain length
+static void max7219_update(const uint8_t (*rows)[MATRIX_HEIGHT])
 {
+    uint8_t data[MAX_MATRICES];
+    bool dirty;
     int matrix, row;
     
     for (row = 0; row < MATRIX_HEIGHT; row++) {
-        for (matrix = 0; matrix < NUM_MATRICES; matrix++) {
-            max7219_send(MAX7219_REG_DIGIT0 + row, 
-                        framebuffer[matrix][row], 
-                        matrix);
+        dirty = !shown_valid;
+        for (matrix = 0; matrix < matrices; matrix++) {
+            data[matrix] = rows[matrix][row];
+            if (shown[matrix][row] != data[matrix])
+                dirty = true;
         }
+        if (!dirty)
+            continue;
+        
+        max7219_send_chain(MAX7219_REG_DIGIT0 + row, data);
+        for (matrix = 0; matrix < matrices; matrix++)
+            shown[matrix][row] = data[matrix];
     }
+    shown_valid = true;
 }
 
+/*
+ * Take a new frame from the shared page, if there is one. Userspace
+ * makes generation odd while it draws, like a seqcount writer; the page
+ * is only copied when generation is even and unchanged across the copy,
+ * so a half-drawn frame is never shown. Called with fb_lock held.
+ * Returns the generation taken, or 0 when there was nothing to take.
+ */
+static u32 page_sync(void)
+{
+    u32 dirty[DIV_ROUND_UP(HISTO_PAGE_MAX_BYTES, 32)];
+    u8 *rows = (u8 *)framebuffer;
+    u32 begin, end;
+    int tries;
+    size_t i;
+    
+    if (shared_page == NULL)
+        return 0;
+    
+    for (tries = 0; tries < 3; tries++) {
+        begin = READ_ONCE(shared_page->generation);
+        if (begin == page_generation || (begin & 1))
+            return 0;
+        smp_rmb();
+        memcpy(dirty, shared_page->dirty, sizeof(dirty));
+        memcpy(page_bytes, shared_page->framebuffer, fb_bytes);
+        smp_rmb();
+        end = READ_ONCE(shared_page->generation);
+        if (begin == end)
+            break;
+    }
+    if (tries == 3)
+        return 0;   // userspace keeps drawing; try again next interval
+    
+    for (i = 0; i < fb_bytes; i++) {
+        if (dirty[i / 32] & (1u << (i % 32)))
+            rows[i] = page_bytes[i];
+    }
+    page_generation = begin;
+    return begin;
+}
+
+/*
+ * Flush worker. It snapshots the framebuffer under the lock and does
+ * the slow bit-banging without it, so writers never wait for SPI.
+ * While the page is mapped it re-arms itself every refresh interval to
+ * notice new generations without an ioctl.
+ */
+static void max7219_flush_work(struct work_struct *work)
+{
+    u32 generation;
+    int level;
+    bool full;
+    
+    mutex_lock(&fb_lock);
+    generation = page_sync();
+    memcpy(flush_rows, framebuffer, fb_bytes);
+    level = pending_intensity;
+    pending_intensity = -1;
+    full = flush_full;
+    flush_full = false;
+    last_flush = jiffies;
+    mutex_unlock(&fb_lock);
+    
+    if (level >= 0)
+        max7219_broadcast(MAX7219_REG_INTENSITY, level);
+    if (full)
+        shown_valid = false;
+    max7219_update(flush_rows);
+    
+    if (generation != 0)
+        WRITE_ONCE(shared_page->flushed, generation);
+    if (atomic_read(&page_maps) > 0)
+        schedule_delayed_work(&flush_work, msecs_to_jiffies(READ_ONCE(refresh_ms)));
+}
+
+// Called with fb_lock held. A flush already queued picks up this change
+// too, so a burst of writes costs one flush per refresh interval.
+static void request_flush(void)
+{
+    unsigned long next = last_flush + msecs_to_jiffies(READ_ONCE(refresh_ms));
+    
+    schedule_delayed_work(&flush_work, time_before(jiffies, next) ? next - jiffies : 0);
+}
+
+// Logical wall coordinates, shared with the ioctls below
+static unsigned int display_width(void);
+static unsigned int display_height(void);
+static uint8_t *display_byte(unsigned int x, unsigned int y);
+
 static void max7219_set_pixel(int x, int y, bool on)
 {
     int matrix, local_x, byte_index, bit_index;
     
-    if (x < 0 || x >= (NUM_MATRICES * 8) || y < 0 || y >= MATRIX_HEIGHT)
+    if (x < 0 || x >= matrices * 8 || y < 0 || y >= MATRIX_HEIGHT)
         return;
     
     matrix = x / 8;
@@ -195,15 +335,33 @@ static ssize_t proc_read(struct file *file, char __user *buf, size_t count, loff
 {
     char msg[128];
     int len;
-    int width = NUM_MATRICES * 8;
-    int height = MATRIX_HEIGHT;
+    int width = tile_cols * 8;
+    int height = tile_rows * MATRIX_HEIGHT;
     
     if (*offset > 0)
         return 0;
     
+    if (file->private_data == QUERY_BINARY) {
+        struct max7219_info info = {
+            .magic = MAX7219_INFO_MAGIC,
+            .version = MAX7219_INFO_VERSION,
+            .size = sizeof(info),
+            .matrices = matrices,
+            .width = width,
+            .height = height,
+        };
+        
+        len = min(count, sizeof(info));
+        if (copy_to_user(buf, &info, len))
+            return -EFAULT;
+        
+        *offset = len;
+        return len;
+    }
+    
     len = snprintf(msg, sizeof(msg), 
                    "matrices=%d\nwidth=%d\nheight=%d\n",
-                   NUM_MATRICES, width, height);
+                   matrices, width, height);
     
     if (copy_to_user(buf, msg, len))
         return -EFAULT;
@@ -212,11 +370,74 @@ static ssize_t proc_read(struct file *file, char __user *buf, size_t count, loff
     return len;
 }
 
-static ssize_t proc_write(struct file *file, const char __user *buf, size_t size, loff_t *offset)
+// Binary blit: fixed header, raw framebuffer rows, no parsing
+static ssize_t blit_write(const char __user *buf, size_t size)
+{
+    struct max7219_blit_header header;
+    uint8_t *payload = blit_payload;
+    uint8_t *rows = (uint8_t *)framebuffer;
+    unsigned int i;
+    
+    if (size < sizeof(header))
+        return -EINVAL;
+    if (copy_from_user(&header, buf, sizeof(header)))
+        return -EFAULT;
+    
+    if (header.matrices != matrices || header.rows != MATRIX_HEIGHT ||
+        header.length > 3 * fb_bytes || size != sizeof(header) + header.length)
+        return -EINVAL;
+    
+    if (copy_from_user(payload, buf + sizeof(header), header.length))
+        return -EFAULT;
+    
+    switch (header.opcode) {
+    case MAX7219_OP_FRAME:
+        if (header.length != fb_bytes)
+            return -EINVAL;
+        memcpy(framebuffer, payload, fb_bytes);
+        break;
+    case MAX7219_OP_UPDATE:
+        if (header.length % 2 != 0)
+            return -EINVAL;
+        for (i = 0; i < header.length; i += 2) {
+            if (payload[i] >= fb_bytes)
+                return -EINVAL;
+        }
+        for (i = 0; i < header.length; i += 2)
+            rows[payload[i]] = payload[i + 1];
+        break;
+    case MAX7219_OP_UPDATE_WIDE:
+        if (header.length % 3 != 0)
+            return -EINVAL;
+        for (i = 0; i < header.length; i += 3) {
+            if ((payload[i] | payload[i + 1] << 8) >= fb_bytes)
+                return -EINVAL;
+        }
+        for (i = 0; i < header.length; i += 3)
+            rows[payload[i] | payload[i + 1] << 8] = payload[i + 2];
+        break;
+    default:
+        return -EINVAL;
+    }
+    
+    if (header.flags & MAX7219_BLIT_FULL)
+        flush_full = true;
+    request_flush();
+    
+    return size;
+}
+
+// Handle one write with fb_lock held
+static ssize_t command_write(struct file *file, const char __user *buf, size_t size)
 {
     char cmd[32];
+    uint8_t first;
     int i;
     
+    if (size > 0 && get_user(first, (const uint8_t __user *)buf) == 0 &&
+        first == MAX7219_BLIT_MAGIC)
+        return blit_write(buf, size);
+    
     memset(data_buffer, 0, sizeof(data_buffer));
     
     if (size > MAX_USER_SIZE)
@@ -228,24 +449,37 @@ static ssize_t proc_write(struct file *file, const char __user *buf, size_t size
     // Parse command
     sscanf(data_buffer, "%31s", cmd);
     
-    if (strcmp(cmd, "clear") == 0) {
-        max7219_clear();
+    if (strcmp(cmd, MAX7219_CMD_QUERY) == 0) {
+        // Later reads on this file return struct max7219_info
+        file->private_data = QUERY_BINARY;
+    }
+    else if (strcmp(cmd, "clear") == 0) {
+        memset(framebuffer, 0, fb_bytes);
+        flush_full = true;
+        request_flush();
         printk(KERN_INFO "MAX7219: Display cleared\n");
     }
     else if (strcmp(cmd, "test") == 0) {
-        // Test pattern
-        for (i = 0; i < NUM_MATRICES * 8; i++) {
-            max7219_set_pixel(i, i % MATRIX_HEIGHT, true);
-        }
-        max7219_update();
+        // Test pattern: a diagonal through every module of the wall
+        for (i = 0; i < (int)display_width(); i++)
+            *display_byte(i, i % display_height()) |= 0x80 >> (i % MATRIX_HEIGHT);
+        request_flush();
         printk(KERN_INFO "MAX7219: Test pattern displayed\n");
     }
     else if (strcmp(cmd, "histogram") == 0) {
         // Format: "histogram " followed by width * height bytes
         char *data_ptr = data_buffer + strlen(cmd) + 1;
-        size_t expected_width = NUM_MATRICES * 8;
+        size_t expected_width = matrices * 8;
         size_t expected_size = strlen(cmd) + 1 + expected_width;
         
+        // Bars run along the chain, which is only the display on one row
+        // of modules; walls take the binary blits or HISTO_IOC_BINS
+        if (tile_rows > 1) {
+            printk(KERN_WARNING "MAX7219: No text histogram on a %ux%u wall\n",
+                   tile_cols, tile_rows);
+            return -EINVAL;
+        }
+        
         printk(KERN_DEBUG "MAX7219: Received %zu bytes, expected %zu bytes (width=%zu)\n", 
                size, expected_size, expected_width);
         
@@ -253,13 +487,13 @@ static ssize_t proc_write(struct file *file, const char __user *buf, size_t size
             int col, row;
             uint8_t *histogram_data = (uint8_t*)data_ptr;
             
-            if (expected_width != NUM_MATRICES * 8) {
+            if (expected_width != matrices * 8) {
                 printk(KERN_WARNING "MAX7219: Histogram width mismatch\n");
                 return -EINVAL;
             }
             
             // Clear framebuffer
-            memset(framebuffer, 0, sizeof(framebuffer));
+            memset(framebuffer, 0, fb_bytes);
             
             // Copy histogram to framebuffer
             // histogram_data[col] contains the height (0-8) for each column
@@ -274,7 +508,7 @@ static ssize_t proc_write(struct file *file, const char __user *buf, size_t size
                 }
             }
             
-            max7219_update();
+            request_flush();
             printk(KERN_INFO "MAX7219: Histogram displayed\n");
         } else {
             printk(KERN_WARNING "MAX7219: Invalid histogram data size (got %zu, need %zu)\n",
@@ -282,11 +516,24 @@ static ssize_t proc_write(struct file *file, const char __user *buf, size_t size
             return -EINVAL;
         }
     }
+    else if (strcmp(cmd, "pixel") == 0) {
+        int x, y, on;
+        
+        if (sscanf(data_buffer, "pixel %d %d %d", &x, &y, &on) != 3 ||
+            x < 0 || x >= matrices * 8 || y < 0 || y >= MATRIX_HEIGHT) {
+            printk(KERN_WARNING "MAX7219: Invalid pixel command\n");
+            return -EINVAL;
+        }
+        
+        max7219_set_pixel(x, y, on != 0);
+        request_flush();
+    }
     else if (strcmp(cmd, "intensity") == 0) {
         int level;
         if (sscanf(data_buffer, "intensity %d", &level) == 1) {
             if (level >= 0 && level <= 15) {
-                max7219_broadcast(MAX7219_REG_INTENSITY, level);
+                pending_intensity = level;
+                request_flush();
                 printk(KERN_INFO "MAX7219: Intensity set to %d\n", level);
             }
         }
@@ -295,18 +542,314 @@ static ssize_t proc_write(struct file *file, const char __user *buf, size_t size
     return size;
 }
 
+static ssize_t proc_write(struct file *file, const char __user *buf, size_t size, loff_t *offset)
+{
+    ssize_t result;
+    
+    mutex_lock(&fb_lock);
+    result = command_write(file, buf, size);
+    mutex_unlock(&fb_lock);
+    
+    return result;
+}
+
 static const struct proc_ops fops = {
     .proc_read = proc_read,
     .proc_write = proc_write,
 };
 
+/*
+ * /dev/histodrv: the libhisto ioctl interface. The display is addressed
+ * in logical orientation, like histogram_lib: the wall is tile_cols
+ * modules wide and tile_rows high, pixel (x, y) (y = 0 at the top) lies
+ * in matrix (y / 8) * tile_cols + x / 8, column x is row 7 - x % 8 of
+ * that matrix and row y is bit 7 - y % 8 of that row's byte.
+ */
+static unsigned int display_width(void)
+{
+    return tile_cols * 8;
+}
+
+static unsigned int display_height(void)
+{
+    return tile_rows * MATRIX_HEIGHT;
+}
+
+static uint8_t *display_byte(unsigned int x, unsigned int y)
+{
+    unsigned int matrix = (y / MATRIX_HEIGHT) * tile_cols + x / 8;
+    
+    return &framebuffer[matrix][MATRIX_HEIGHT - 1 - x % 8];
+}
+
+// Bins per column and the bars, in integer math. Called with fb_lock held.
+static u32 ioctl_bins[HISTO_IOC_BINS_COUNT];
+static u64 *column_sums = NULL;     // display_width() entries
+
+static void display_bins(const u32 *bins)
+{
+    unsigned int width = display_width();
+    unsigned int height = display_height();
+    unsigned int first, last, h, lit, tile, x, i;
+    u64 max_sum = 0;
+    
+    // Column x sums the whole bins [x * 256 / width, (x + 1) * 256 / width),
+    // at least one of them. When width doesn't divide 256 the columns get
+    // unequal bin counts; histogram_lib's plans split the boundary bins
+    // instead, so the bars can differ from histogram_dimension()'s there.
+    for (x = 0; x < width; x++) {
+        first = x * HISTO_IOC_BINS_COUNT / width;
+        last = max((x + 1) * HISTO_IOC_BINS_COUNT / width, first + 1);
+        column_sums[x] = 0;
+        for (i = first; i < last; i++)
+            column_sums[x] += bins[i];
+        if (column_sums[x] > max_sum)
+            max_sum = column_sums[x];
+    }
+    
+    // Height h is reached once sum / max >= h / height, evaluated
+    // exactly. A bar fills the bottom rows of each module row it reaches.
+    for (x = 0; x < width; x++) {
+        h = max_sum == 0 ? 0 : (unsigned int)div64_u64(column_sums[x] * height, max_sum);
+        for (tile = 0; tile < tile_rows; tile++) {
+            lit = clamp_t(int, (int)h - (int)(height - (tile + 1) * MATRIX_HEIGHT),
+                          0, MATRIX_HEIGHT);
+            *display_byte(x, tile * MATRIX_HEIGHT) = (uint8_t)((1u << lit) - 1);
+        }
+    }
+}
+
+static unsigned int display_status(void)
+{
+    const uint8_t *rows = (const uint8_t *)framebuffer;
+    unsigned int status = HISTO_STATUS_READY;
+    size_t i;
+    
+    if (delayed_work_pending(&flush_work))
+        status |= HISTO_STATUS_FLUSH_PENDING;
+    
+    for (i = 0; i < fb_bytes && rows[i] == 0; i++)
+        ;
+    if (i == fb_bytes)
+        status |= HISTO_STATUS_BLANK;
+    
+    return status;
+}
+
+static long histo_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    void __user *argp = (void __user *)arg;
+    unsigned int status, x, y;
+    int index;
+    long result = 0;
+    
+    switch (cmd) {
+    case HISTO_IOC_LED_ON:
+    case HISTO_IOC_LED_OFF:
+        if (get_user(index, (int __user *)argp))
+            return -EFAULT;
+        if (index < 0 || index >= display_width() * display_height())
+            return -EINVAL;
+        x = index % display_width();
+        y = index / display_width();
+        
+        mutex_lock(&fb_lock);
+        if (cmd == HISTO_IOC_LED_ON)
+            *display_byte(x, y) |= 0x80 >> (y % MATRIX_HEIGHT);
+        else
+            *display_byte(x, y) &= ~(0x80 >> (y % MATRIX_HEIGHT));
+        request_flush();
+        mutex_unlock(&fb_lock);
+        break;
+    case HISTO_IOC_CLEAR:
+        mutex_lock(&fb_lock);
+        memset(framebuffer, 0, fb_bytes);
+        flush_full = true;
+        request_flush();
+        mutex_unlock(&fb_lock);
+        break;
+    case HISTO_IOC_BINS:
+        mutex_lock(&fb_lock);
+        if (copy_from_user(ioctl_bins, argp, sizeof(ioctl_bins))) {
+            result = -EFAULT;
+        } else {
+            display_bins(ioctl_bins);
+            request_flush();
+        }
+        mutex_unlock(&fb_lock);
+        break;
+    case HISTO_IOC_FLUSH:
+        mutex_lock(&fb_lock);
+        request_flush();
+        mutex_unlock(&fb_lock);
+        break;
+    case HISTO_IOC_STATUS:
+        mutex_lock(&fb_lock);
+        status = display_status();
+        mutex_unlock(&fb_lock);
+        if (put_user(status, (unsigned int __user *)argp))
+            return -EFAULT;
+        break;
+    default:
+        return -ENOTTY;
+    }
+    
+    return result;
+}
+
+static void histo_vm_open(struct vm_area_struct *vma)
+{
+    atomic_inc(&page_maps);
+}
+
+static void histo_vm_close(struct vm_area_struct *vma)
+{
+    atomic_dec(&page_maps);
+}
+
+static const struct vm_operations_struct histo_vm_ops = {
+    .open = histo_vm_open,
+    .close = histo_vm_close,
+};
+
+// Map the shared framebuffer page; the mapping holds its own page reference.
+// Only MAP_SHARED: a private mapping would give userspace a copy-on-write
+// page the driver never sees.
+static int histo_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    int ret;
+    
+    if (shared_page == NULL)
+        return -ENODEV;
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE)
+        return -EINVAL;
+    if (!(vma->vm_flags & VM_SHARED) || (vma->vm_flags & VM_EXEC))
+        return -EINVAL;
+    vm_flags_clear(vma, VM_MAYEXEC);
+    
+    ret = vm_insert_page(vma, vma->vm_start, virt_to_page(shared_page));
+    if (ret)
+        return ret;
+    
+    vma->vm_ops = &histo_vm_ops;
+    histo_vm_open(vma);
+    
+    // Start polling the generation
+    mutex_lock(&fb_lock);
+    request_flush();
+    mutex_unlock(&fb_lock);
+    return 0;
+}
+
+static const struct file_operations histo_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = histo_ioctl,
+    .mmap = histo_mmap,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = noop_llseek,
+};
+
+static struct miscdevice histo_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "histodrv",
+    .fops = &histo_fops,
+    .mode = 0666,
+};
+static bool histo_registered = false;
+
+static void free_buffers(void)
+{
+    kfree(framebuffer);
+    kfree(shown);
+    kfree(flush_rows);
+    kfree(blit_payload);
+    kfree(page_bytes);
+    kfree(column_sums);
+    framebuffer = shown = flush_rows = NULL;
+    blit_payload = page_bytes = NULL;
+    column_sums = NULL;
+}
+
+// Every MOSI pin must be in GPSET0/GPCLR0, once, and not CLK or CS
+static int check_lanes(void)
+{
+    u32 used = (1u << SPI_CLK) | (1u << SPI_CS);
+    int lane;
+    
+    if (lanes < 1 || matrices % lanes != 0) {
+        printk(KERN_ALERT "MAX7219: %d lanes don't divide matrices=%u\n", lanes, matrices);
+        return -EINVAL;
+    }
+    for (lane = 0; lane < lanes; lane++) {
+        if (mosi_pins[lane] >= 32 || (used & (1u << mosi_pins[lane]))) {
+            printk(KERN_ALERT "MAX7219: Invalid or repeated MOSI pin %u\n", mosi_pins[lane]);
+            return -EINVAL;
+        }
+        used |= 1u << mosi_pins[lane];
+    }
+    lane_matrices = matrices / lanes;
+    
+    return 0;
+}
+
+// Check the layout parameters and size every buffer from them
+static int alloc_buffers(void)
+{
+    if (matrices < 1 || matrices > MAX_MATRICES) {
+        printk(KERN_ALERT "MAX7219: matrices must be 1-%d, not %u\n", MAX_MATRICES, matrices);
+        return -EINVAL;
+    }
+    if (tile_cols == 0) {
+        // One row if it fits, else rows as wide as allowed
+        tile_cols = min_t(unsigned int, matrices, MAX_TILE_COLS);
+        while (matrices % tile_cols != 0)
+            tile_cols--;
+    }
+    if (tile_cols > matrices || matrices % tile_cols != 0) {
+        printk(KERN_ALERT "MAX7219: tile_cols=%u doesn't divide matrices=%u\n",
+               tile_cols, matrices);
+        return -EINVAL;
+    }
+    if (tile_cols > MAX_TILE_COLS) {
+        printk(KERN_ALERT "MAX7219: tile_cols=%u is over %d: rows wider than 256 columns\n",
+               tile_cols, MAX_TILE_COLS);
+        return -EINVAL;
+    }
+    tile_rows = matrices / tile_cols;
+    fb_bytes = matrices * MATRIX_HEIGHT;
+    if (check_lanes())
+        return -EINVAL;
+    
+    framebuffer = kzalloc(fb_bytes, GFP_KERNEL);
+    shown = kzalloc(fb_bytes, GFP_KERNEL);
+    flush_rows = kzalloc(fb_bytes, GFP_KERNEL);
+    blit_payload = kmalloc(3 * fb_bytes, GFP_KERNEL);
+    page_bytes = kmalloc(fb_bytes, GFP_KERNEL);
+    column_sums = kcalloc(display_width(), sizeof(*column_sums), GFP_KERNEL);
+    if (framebuffer == NULL || shown == NULL || flush_rows == NULL ||
+        blit_payload == NULL || page_bytes == NULL || column_sums == NULL) {
+        printk(KERN_ALERT "MAX7219: Failed to allocate the framebuffer\n");
+        free_buffers();
+        return -ENOMEM;
+    }
+    
+    return 0;
+}
+
 static int __init max7219_driver_init(void)
 {
+    int ret;
+    
+    ret = alloc_buffers();
+    if (ret)
+        return ret;
+    
     // Map GPIO memory
     gpio_registers = (unsigned int*)ioremap(BCM2837_GPIO_ADDRESS, PAGE_SIZE);
     
     if (gpio_registers == NULL) {
         printk(KERN_ALERT "MAX7219: Failed to map GPIO memory\n");
+        free_buffers();
         return -ENOMEM;
     }
     
@@ -314,6 +857,7 @@ static int __init max7219_driver_init(void)
     
     // Initialize hardware
     max7219_init();
+    last_flush = jiffies;
     
     // Create proc
     proc_entry = proc_create("max7219", 0666, NULL, &fops);
@@ -321,34 +865,65 @@ static int __init max7219_driver_init(void)
         printk(KERN_ALERT "MAX7219: Failed to create /proc/max7219\n");
         iounmap(gpio_registers);
         gpio_registers = NULL;
+        free_buffers();
         return -ENOMEM;
     }
     
+    shared_page = (struct histo_page *)get_zeroed_page(GFP_KERNEL);
+    if (shared_page != NULL) {
+        shared_page->magic = HISTO_PAGE_MAGIC;
+        shared_page->matrices = matrices;
+        shared_page->rows = MATRIX_HEIGHT;
+        shared_page->width = display_width();
+        shared_page->height = display_height();
+    } else {
+        printk(KERN_WARNING "MAX7219: No shared framebuffer page, mmap disabled\n");
+    }
+    
+    if (misc_register(&histo_device) == 0)
+        histo_registered = true;
+    else
+        printk(KERN_WARNING "MAX7219: Failed to register /dev/histodrv, ioctl interface disabled\n");
+    
     printk(KERN_INFO "MAX7219: Driver loaded successfully\n");
-    printk(KERN_INFO "MAX7219: Matrices=%d, Resolution=%dx%d\n", 
-           NUM_MATRICES, NUM_MATRICES * 8, MATRIX_HEIGHT);
-    printk(KERN_INFO "MAX7219: SPI Pins - MOSI:%d CLK:%d CS:%d\n", 
-           SPI_MOSI, SPI_CLK, SPI_CS);
+    printk(KERN_INFO "MAX7219: Matrices=%u (%ux%u modules), Resolution=%ux%u\n", 
+           matrices, tile_cols, tile_rows, display_width(), display_height());
+    printk(KERN_INFO "MAX7219: SPI Pins - MOSI:%u (%d lanes of %u matrices) CLK:%d CS:%d\n", 
+           mosi_pins[0], lanes, lane_matrices, SPI_CLK, SPI_CS);
+    printk(KERN_INFO "MAX7219: Refresh interval %u ms\n", refresh_ms);
     
     return 0;
 }
 
 static void __exit max7219_driver_exit(void)
 {
-    if (gpio_registers != NULL) {
-        max7219_clear();
-        max7219_broadcast(MAX7219_REG_SHUTDOWN, 0x00);
+    // No new writes, then no flush in flight, before touching the SPI pins
+    if (histo_registered) {
+        misc_deregister(&histo_device);
+        histo_registered = false;
     }
-    
     if (proc_entry != NULL) {
         proc_remove(proc_entry);
         proc_entry = NULL;
     }
+    cancel_delayed_work_sync(&flush_work);
+    
+    // Mappings still alive keep their own reference to the page
+    if (shared_page != NULL) {
+        free_page((unsigned long)shared_page);
+        shared_page = NULL;
+    }
+    
+    if (gpio_registers != NULL) {
+        max7219_clear();
+        max7219_broadcast(MAX7219_REG_SHUTDOWN, 0x00);
+    }
     
     if (gpio_registers != NULL) {
         iounmap(gpio_registers);
         gpio_registers = NULL;
     }
+    free_buffers();
     
     printk(KERN_INFO "MAX7219: Driver unloaded successfully\n");
 }
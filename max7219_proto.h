@@ -0,0 +1,91 @@
+#ifndef MAX7219_PROTO_H
+#define MAX7219_PROTO_H
+
+/*
+ * Binary messages exchanged over /proc/max7219, shared by the kernel
+ * driver and histogram_lib. All fields are in host byte order: both
+ * sides always run on the same machine.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+/**
+ * @brief Command that switches an open file to binary query replies
+ *
+ * After writing it, reading the file at offset 0 returns a
+ * struct max7219_info instead of the "matrices=...\n" text.
+ */
+#define MAX7219_CMD_QUERY "query"
+
+#define MAX7219_INFO_MAGIC   0x4937384Du  /* "M87I" */
+#define MAX7219_INFO_VERSION 3   /* 2: binary blits, 3: multi-row walls */
+
+/**
+ * @brief First versions with binary blits and with multi-row walls
+ */
+#define MAX7219_INFO_VERSION_BLIT 2
+#define MAX7219_INFO_VERSION_WALL 3
+
+/**
+ * @brief Display geometry returned by the binary query
+ *
+ * The modules form a wall of height / 8 rows of width / 8 modules each,
+ * filled row by row in chain order from the top left: matrix m is module
+ * m % (width / 8) of module row m / (width / 8), and matrix 0 is the
+ * first one after the Pi. Drivers before MAX7219_INFO_VERSION_WALL only
+ * have a single row.
+ */
+struct max7219_info {
+    uint32_t magic;       /**< MAX7219_INFO_MAGIC */
+    uint16_t version;     /**< MAX7219_INFO_VERSION */
+    uint16_t size;        /**< sizeof(struct max7219_info) as built by the driver */
+    uint16_t matrices;    /**< Matrices in the chain */
+    uint16_t width;       /**< Display width in pixels */
+    uint16_t height;      /**< Display height in pixels */
+    uint16_t reserved;
+};
+
+/**
+ * @brief First byte of a binary blit; never the start of a text command
+ */
+#define MAX7219_BLIT_MAGIC 0xB7
+
+/**
+ * @brief Blit opcodes
+ *
+ * MAX7219_OP_FRAME carries the whole framebuffer: matrices * rows bytes
+ * in framebuffer[matrix][row] order, bit 7 being the leftmost LED of a
+ * row. MAX7219_OP_UPDATE carries only changed rows as (index, value)
+ * byte pairs, index being matrix * rows + row in that layout.
+ * MAX7219_OP_UPDATE_WIDE is the same with (index low, index high, value)
+ * triplets, for framebuffers over 256 bytes (MAX7219_INFO_VERSION_WALL).
+ */
+#define MAX7219_OP_FRAME       1
+#define MAX7219_OP_UPDATE      2
+#define MAX7219_OP_UPDATE_WIDE 3
+
+/**
+ * @brief Blit flag: reclock every row, not just the ones that changed
+ */
+#define MAX7219_BLIT_FULL 0x0001
+
+/**
+ * @brief Header of a binary blit, followed by @c length payload bytes
+ *
+ * The whole blit is one write(); the driver copies the payload straight
+ * into its framebuffer and flushes.
+ */
+struct max7219_blit_header {
+    uint8_t magic;        /**< MAX7219_BLIT_MAGIC */
+    uint8_t opcode;       /**< MAX7219_OP_* */
+    uint8_t matrices;     /**< Must match the driver */
+    uint8_t rows;         /**< Rows per matrix, must match the driver */
+    uint16_t flags;       /**< MAX7219_BLIT_* */
+    uint16_t length;      /**< Payload bytes */
+};
+
+#endif // MAX7219_PROTO_H
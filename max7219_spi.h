@@ -0,0 +1,161 @@
+#ifndef MAX7219_SPI_H
+#define MAX7219_SPI_H
+
+/*
+ * Bit-banged SPI to one or more MAX7219 chains over the BCM2837 GPIO
+ * block. The chains (lanes) share CLK and CS and each has its own MOSI
+ * pin; GPSET0/GPCLR0 change every pin of a mask with one store, so all
+ * lanes shift their bits on the same clock edges and N chains refresh
+ * in the time of one.
+ *
+ * The code only touches the registers through the pointer it is given.
+ * Outside the kernel it builds against a plain array standing in for
+ * the GPIO block; defining MAX7219_GPIO_WRITE before including this
+ * header sees every store to GPSET0/GPCLR0 in order.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/delay.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+/**
+ * @brief Register indexes (32-bit words) in the GPIO block
+ */
+#define MAX7219_GPFSEL0 0
+#define MAX7219_GPSET0  (0x1C / 4)
+#define MAX7219_GPCLR0  (0x28 / 4)
+
+/**
+ * @brief Most lanes a struct max7219_spi drives
+ */
+#define MAX7219_SPI_MAX_LANES 8
+
+/**
+ * @brief Store one GPIO register; may be overridden to observe stores
+ */
+#ifndef MAX7219_GPIO_WRITE
+#define MAX7219_GPIO_WRITE(regs, index, value) ((regs)[index] = (value))
+#endif
+
+/**
+ * @brief Half clock period; a no-op outside the kernel unless defined
+ */
+#ifndef MAX7219_SPI_DELAY
+#ifdef __KERNEL__
+#define MAX7219_SPI_DELAY() udelay(5)
+#else
+#define MAX7219_SPI_DELAY() do { } while (0)
+#endif
+#endif
+
+/**
+ * @brief Pins and line state of a set of lanes
+ */
+struct max7219_spi {
+    volatile uint32_t *regs;    /**< GPIO block, or a mock of it */
+    uint32_t clk;               /**< CLK pin mask */
+    uint32_t cs;                /**< CS pin mask */
+    uint32_t mosi[MAX7219_SPI_MAX_LANES];  /**< MOSI pin mask of each lane */
+    uint32_t mosi_all;          /**< Every MOSI pin */
+    uint32_t mosi_high;         /**< MOSI pins last driven high */
+    unsigned int lanes;
+};
+
+static inline void max7219_gpio_output(volatile uint32_t *regs, unsigned int pin)
+{
+    unsigned int reg = MAX7219_GPFSEL0 + pin / 10;
+    unsigned int shift = (pin % 10) * 3;
+
+    regs[reg] = (regs[reg] & ~(7u << shift)) | (1u << shift);   // 001: output
+}
+
+/**
+ * @brief Set up the pins: all outputs, CLK and MOSI low, CS high
+ *
+ * Pins must be below 32 (GPSET0/GPCLR0) and distinct; the caller checks.
+ */
+static inline void max7219_spi_init(struct max7219_spi *spi, volatile uint32_t *regs,
+                                    unsigned int clk_pin, unsigned int cs_pin,
+                                    const unsigned int *mosi_pins, unsigned int lanes)
+{
+    unsigned int lane;
+
+    spi->regs = regs;
+    spi->clk = 1u << clk_pin;
+    spi->cs = 1u << cs_pin;
+    spi->lanes = lanes;
+    spi->mosi_all = 0;
+    for (lane = 0; lane < lanes; lane++) {
+        spi->mosi[lane] = 1u << mosi_pins[lane];
+        spi->mosi_all |= spi->mosi[lane];
+        max7219_gpio_output(regs, mosi_pins[lane]);
+    }
+    max7219_gpio_output(regs, clk_pin);
+    max7219_gpio_output(regs, cs_pin);
+
+    MAX7219_GPIO_WRITE(regs, MAX7219_GPCLR0, spi->clk | spi->mosi_all);
+    MAX7219_GPIO_WRITE(regs, MAX7219_GPSET0, spi->cs);
+    spi->mosi_high = 0;
+}
+
+/**
+ * @brief Shift one byte into every lane, MSB first
+ * @param bytes One byte per lane
+ *
+ * Per bit, the falling clock edge and the MOSI pins going low share one
+ * GPCLR write, and the MOSI pins going high get one GPSET before the
+ * rising clock edge, which keeps the data setup time. Pins that keep
+ * their level aren't written, so a bit costs two to three stores
+ * whatever the number of lanes.
+ */
+static inline void max7219_spi_shift(struct max7219_spi *spi, const uint8_t *bytes)
+{
+    uint32_t level, fall, rise;
+    unsigned int lane;
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        level = 0;
+        for (lane = 0; lane < spi->lanes; lane++) {
+            if ((bytes[lane] >> i) & 1)
+                level |= spi->mosi[lane];
+        }
+        fall = spi->mosi_high & ~level;
+        rise = level & ~spi->mosi_high;
+
+        MAX7219_GPIO_WRITE(spi->regs, MAX7219_GPCLR0, spi->clk | fall);
+        if (rise)
+            MAX7219_GPIO_WRITE(spi->regs, MAX7219_GPSET0, rise);
+        spi->mosi_high = level;
+
+        MAX7219_SPI_DELAY();
+        MAX7219_GPIO_WRITE(spi->regs, MAX7219_GPSET0, spi->clk);
+        MAX7219_SPI_DELAY();
+    }
+    MAX7219_GPIO_WRITE(spi->regs, MAX7219_GPCLR0, spi->clk);
+}
+
+/**
+ * @brief Start a CS frame on every lane
+ */
+static inline void max7219_spi_select(struct max7219_spi *spi)
+{
+    MAX7219_GPIO_WRITE(spi->regs, MAX7219_GPCLR0, spi->cs);
+    MAX7219_SPI_DELAY();
+}
+
+/**
+ * @brief End the CS frame: every chain latches what was shifted in
+ */
+static inline void max7219_spi_deselect(struct max7219_spi *spi)
+{
+    MAX7219_SPI_DELAY();
+    MAX7219_GPIO_WRITE(spi->regs, MAX7219_GPSET0, spi->cs);
+    MAX7219_SPI_DELAY();
+}
+
+#endif // MAX7219_SPI_H
@@ -0,0 +1,134 @@
+/*
+ * Userspace test of the histogram kernels: every SIMD kernel and thread
+ * count must give exactly the per-pixel HISTOGRAM_LUMA() histogram on
+ * random images with awkward sizes (odd widths, tails shorter than a
+ * vector, more threads than rows) and unaligned rows. That histogram is
+ * also held against compute_histogram_reference(): equal for grayscale,
+ * and for colour no pixel more than the documented one level away.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "histogram_compute.h"
+
+static const int widths[] = { 1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 129, 257 };
+static const int heights[] = { 1, 2, 3, 5, 17 };
+static const int channel_counts[] = { 1, 3, 4 };
+static const int thread_counts[] = { 1, 2, 3, 8, 64 };
+static const histogram_kernel_t kernels[] = {
+    HISTOGRAM_KERNEL_AUTO, HISTOGRAM_KERNEL_SCALAR, HISTOGRAM_KERNEL_SSE2, HISTOGRAM_KERNEL_AVX2
+};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static int failures = 0;
+
+// HISTOGRAM_LUMA() one pixel at a time; returns how many pixels land on
+// another level than the double-precision reference formula
+static int expected_histogram(const unsigned char *image, int width, int height, int channels,
+                              uint32_t histogram[256])
+{
+    size_t pixels = (size_t)width * height, i;
+    const unsigned char *p;
+    int level, exact, moved = 0;
+
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+    for (i = 0; i < pixels; i++) {
+        p = image + i * channels;
+        if (channels >= 3) {
+            level = HISTOGRAM_LUMA(p[0], p[1], p[2]);
+            exact = (int)(0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2]);
+        } else {
+            level = exact = p[0];
+        }
+        if (level != exact) {
+            moved++;
+            if (level - exact > 1 || exact - level > 1) {
+                fprintf(stderr, "FAIL luma: %d,%d,%d gives %d, reference %d\n",
+                        p[0], p[1], p[2], level, exact);
+                failures++;
+            }
+        }
+        histogram[level]++;
+    }
+    return moved;
+}
+
+static void check(const char *what, const uint32_t histogram[256], const uint32_t expected[256],
+                  int width, int height, int channels, histogram_kernel_t kernel, int threads)
+{
+    if (memcmp(histogram, expected, 256 * sizeof(uint32_t)) == 0)
+        return;
+    fprintf(stderr, "FAIL %s: %dx%d, %d channels, %s kernel, %d threads\n", what, width,
+            height, channels, histogram_kernel_name(kernel), threads);
+    failures++;
+}
+
+int main(void)
+{
+    uint32_t reference[256], expected[256], histogram[256];
+    unsigned char *buffer, *image;
+    size_t size, i;
+    size_t k, w, h, c, t;
+    int cases = 0;
+
+    srand(256);
+
+    for (k = 0; k < COUNT(kernels); k++) {
+        if (histogram_kernel_resolve(kernels[k]) != kernels[k] &&
+            kernels[k] != HISTOGRAM_KERNEL_AUTO)
+            printf("%s kernel not supported here, runs as %s\n",
+                   histogram_kernel_name(kernels[k]),
+                   histogram_kernel_name(histogram_kernel_resolve(kernels[k])));
+    }
+
+    for (c = 0; c < COUNT(channel_counts); c++) {
+        for (w = 0; w < COUNT(widths); w++) {
+            for (h = 0; h < COUNT(heights); h++) {
+                int channels = channel_counts[c];
+                int width = widths[w], height = heights[h];
+
+                // One byte in, so no row starts on a vector boundary
+                size = (size_t)width * height * channels;
+                buffer = malloc(size + 1);
+                if (buffer == NULL) {
+                    perror("Failed to allocate image");
+                    return 1;
+                }
+                image = buffer + 1;
+                for (i = 0; i < size; i++)
+                    image[i] = (unsigned char)rand();
+
+                compute_histogram_reference(image, width, height, channels, reference);
+                if (expected_histogram(image, width, height, channels, expected) == 0)
+                    check("reference", reference, expected, width, height, channels,
+                          HISTOGRAM_KERNEL_SCALAR, 1);
+
+                for (k = 0; k < COUNT(kernels); k++) {
+                    compute_histogram_kernel(image, width, height, channels, histogram,
+                                             kernels[k]);
+                    check("kernel", histogram, expected, width, height, channels,
+                          kernels[k], 1);
+
+                    for (t = 0; t < COUNT(thread_counts); t++) {
+                        compute_histogram_parallel(image, width, height, channels, histogram,
+                                                   kernels[k], thread_counts[t]);
+                        check("parallel", histogram, expected, width, height, channels,
+                              kernels[k], thread_counts[t]);
+                        cases++;
+                    }
+                }
+
+                free(buffer);
+            }
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d of %d cases failed\n", failures, cases);
+        return 1;
+    }
+    printf("All %d kernel and thread cases match the reference\n", cases);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Userspace test of the dimensioning plans: histogram_plan_apply() must
+ * give the heights of a double-precision rebinning (each input bin shared
+ * between columns by its exact overlap, normalized to the tallest column,
+ * then mapped through the scale) for widths that don't divide the input.
+ * The plans work in Q16 bin weights and Q32 ratios, so a column whose
+ * exact ratio lies within PLAN_TOLERANCE of a threshold may land on
+ * either side of it (ties for the tallest column included); every other
+ * column must match exactly, and some column always reaches the full
+ * height.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "histogram_lib.h"
+
+#define PLAN_TOLERANCE (1.0 / 4096)
+#define RANDOM_ROUNDS 60
+
+static const int input_counts[] = { 256, 200, 64 };
+static const int widths[] = { 1, 7, 24, 32, 40, 100, 255, 256 };
+static const int heights[] = { 8, 16, 255 };
+static const histogram_scale_t scales[] = {
+    HISTOGRAM_SCALE_LINEAR, HISTOGRAM_SCALE_SQRT, HISTOGRAM_SCALE_LOG
+};
+static const char *const scale_names[] = { "linear", "sqrt", "log" };
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static int failures = 0;
+static int columns_checked = 0;
+
+// Bar height for an exact ratio of the tallest column
+static int reference_level(double ratio, int height, histogram_scale_t scale)
+{
+    double level;
+    int k, count = 0;
+
+    for (k = 0; k < height; k++) {
+        level = (double)(k + 1) / height;
+        if (scale == HISTOGRAM_SCALE_SQRT)
+            level = level * level;
+        else if (scale == HISTOGRAM_SCALE_LOG)
+            level = pow(10.0, HISTOGRAM_LOG_DECADES * (level - 1.0));
+        if (k + 1 == height)
+            level = 1.0;
+        count += ratio >= level;
+    }
+    return count;
+}
+
+static void check_plan(const uint32_t *input, int bins, int width, int height,
+                       histogram_scale_t scale, const char *what)
+{
+    double column[256], max = 0.0, start, end, overlap, ratio;
+    uint8_t output[256];
+    histogram_plan_t *plan;
+    int col, i, low, high, tallest = 0;
+
+    plan = histogram_plan_create(bins, width, height, scale);
+    if (plan == NULL) {
+        fprintf(stderr, "FAIL: no plan for %d bins to %dx%d\n", bins, width, height);
+        failures++;
+        return;
+    }
+    if (histogram_plan_apply(plan, input, output) < 0) {
+        fprintf(stderr, "FAIL: plan_apply failed\n");
+        failures++;
+        histogram_plan_destroy(plan);
+        return;
+    }
+    histogram_plan_destroy(plan);
+
+    // Column c covers [c * bins / width, (c + 1) * bins / width) in bin units
+    for (col = 0; col < width; col++) {
+        start = (double)col * bins / width;
+        end = (double)(col + 1) * bins / width;
+        column[col] = 0.0;
+        for (i = (int)start; i < bins && i < end; i++) {
+            overlap = fmin(end, i + 1.0) - fmax(start, (double)i);
+            if (overlap > 0.0)
+                column[col] += overlap * input[i];
+        }
+        max = fmax(max, column[col]);
+    }
+
+    for (col = 0; col < width; col++) {
+        ratio = max > 0.0 ? column[col] / max : 0.0;
+        tallest = output[col] > tallest ? output[col] : tallest;
+        if (ratio == 0.0) {
+            low = high = 0;
+        } else {
+            low = reference_level(ratio - PLAN_TOLERANCE, height, scale);
+            high = reference_level(ratio + PLAN_TOLERANCE, height, scale);
+        }
+        columns_checked++;
+        if (output[col] < low || output[col] > high) {
+            fprintf(stderr, "FAIL %s: %d bins to %dx%d %s, column %d: %d, want %d..%d "
+                    "(ratio %.6f)\n", what, bins, width, height, scale_names[scale], col,
+                    output[col], low, high, ratio);
+            failures++;
+        }
+    }
+    if (max > 0.0 && tallest != height) {
+        fprintf(stderr, "FAIL %s: %d bins to %dx%d %s, tallest column %d\n", what, bins, width,
+                height, scale_names[scale], tallest);
+        failures++;
+    }
+}
+
+int main(void)
+{
+    uint32_t input[256];
+    size_t b, w, h, s;
+    int round, i, bins, bin;
+
+    srand(16);
+
+    for (b = 0; b < COUNT(input_counts); b++) {
+        bins = input_counts[b];
+        for (w = 0; w < COUNT(widths); w++) {
+            if (widths[w] > bins)
+                continue;
+            for (h = 0; h < COUNT(heights); h++) {
+                for (s = 0; s < COUNT(scales); s++) {
+                    memset(input, 0, sizeof(input));
+                    check_plan(input, bins, widths[w], heights[h], scales[s], "all zero");
+
+                    // A single spike in every bin, split or whole
+                    for (bin = 0; bin < bins; bin++) {
+                        memset(input, 0, sizeof(input));
+                        input[bin] = bin % 2 ? 1 : UINT32_MAX;
+                        check_plan(input, bins, widths[w], heights[h], scales[s], "spike");
+                    }
+
+                    // Full-range counts, small counts and sparse counts
+                    for (round = 0; round < RANDOM_ROUNDS; round++) {
+                        for (i = 0; i < bins; i++) {
+                            switch (round % 3) {
+                            case 0:
+                                input[i] = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+                                break;
+                            case 1:
+                                input[i] = (uint32_t)(rand() % 50);
+                                break;
+                            default:
+                                input[i] = rand() % 8 == 0 ? (uint32_t)rand() : 0;
+                                break;
+                            }
+                        }
+                        check_plan(input, bins, widths[w], heights[h], scales[s], "random");
+                    }
+                }
+            }
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d of %d columns failed\n", failures, columns_checked);
+        return 1;
+    }
+    printf("All %d plan columns match the double-precision reference\n", columns_checked);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Userspace test of the integral-histogram index: every region query,
+ * answered from tile corners plus edge strips, must equal a direct
+ * rescan of the region. Regions are random, aligned to tile edges,
+ * one pixel, whole rows and columns, and touching the right and bottom
+ * edges, on images whose sizes aren't multiples of the tile.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "histogram_compute.h"
+#include "histogram_roi.h"
+
+#define RANDOM_REGIONS 300
+
+static const int sizes[][2] = { { 1, 1 }, { 33, 1 }, { 1, 40 }, { 64, 64 }, { 100, 70 },
+                                { 257, 129 } };
+static const int channel_counts[] = { 1, 2, 3, 4 };
+static const int tiles[] = { 1, 7, 32 };
+static const int bin_counts[] = { 1, 32, 256 };
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static int failures = 0;
+static int queries = 0;
+
+// Luma the way the index converts it, one pixel at a time
+static uint8_t pixel_luma(const unsigned char *image, int width, int channels, int x, int y)
+{
+    const unsigned char *p = image + ((size_t)y * width + x) * channels;
+
+    return channels >= 3 ? (uint8_t)HISTOGRAM_LUMA(p[0], p[1], p[2]) : p[0];
+}
+
+static void check_region(const histogram_index_t *index, const unsigned char *image, int width,
+                         int height, int channels, int tile, int x, int y, int w, int h)
+{
+    uint32_t histogram[256], expected[256];
+    int bins = histogram_index_bins(index);
+    int64_t pixels;
+    int i, j;
+
+    memset(expected, 0, sizeof(expected));
+    for (j = y; j < y + h; j++) {
+        for (i = x; i < x + w; i++)
+            expected[pixel_luma(image, width, channels, i, j) * bins / 256]++;
+    }
+
+    pixels = histogram_index_query(index, x, y, w, h, histogram);
+    queries++;
+    if (pixels != (int64_t)w * h ||
+        memcmp(histogram, expected, (size_t)bins * sizeof(uint32_t)) != 0) {
+        fprintf(stderr, "FAIL: %dx%d image, %d channels, tile %d, %d bins: region %d,%d,%d,%d\n",
+                width, height, channels, tile, bins, x, y, w, h);
+        failures++;
+    }
+}
+
+static void test_index(const unsigned char *image, int width, int height, int channels,
+                       int tile, int bins)
+{
+    histogram_index_t *index;
+    uint32_t histogram[256];
+    int n, x, y, w, h;
+
+    index = histogram_index_create(image, width, height, channels, tile, bins);
+    if (index == NULL) {
+        fprintf(stderr, "FAIL: no index for %dx%d, tile %d, %d bins\n", width, height, tile,
+                bins);
+        failures++;
+        return;
+    }
+
+    // Whole image, single pixels in the corners, whole rows and columns
+    check_region(index, image, width, height, channels, tile, 0, 0, width, height);
+    check_region(index, image, width, height, channels, tile, 0, 0, 1, 1);
+    check_region(index, image, width, height, channels, tile, width - 1, height - 1, 1, 1);
+    check_region(index, image, width, height, channels, tile, 0, height / 2, width, 1);
+    check_region(index, image, width, height, channels, tile, width / 2, 0, 1, height);
+
+    for (n = 0; n < RANDOM_REGIONS; n++) {
+        x = rand() % width;
+        y = rand() % height;
+        switch (n % 5) {
+        case 0:     // single pixel
+            w = h = 1;
+            break;
+        case 1:     // starting and ending on tile edges where the image allows
+            x -= x % tile;
+            y -= y % tile;
+            w = (1 + rand() % 4) * tile;
+            h = (1 + rand() % 4) * tile;
+            break;
+        case 2:     // one pixel either side of a tile edge
+            x = x - x % tile + (x % 2 ? tile - 1 : 1);
+            y = y - y % tile + (y % 2 ? tile - 1 : 1);
+            w = tile + 1 + rand() % (2 * tile);
+            h = tile + 1 + rand() % (2 * tile);
+            break;
+        case 3:     // reaching the right and bottom edges
+            w = width - x;
+            h = height - y;
+            break;
+        default:
+            w = 1 + rand() % width;
+            h = 1 + rand() % height;
+            break;
+        }
+        if (x >= width)
+            x = width - 1;
+        if (y >= height)
+            y = height - 1;
+        if (w > width - x)
+            w = width - x;
+        if (h > height - y)
+            h = height - y;
+        check_region(index, image, width, height, channels, tile, x, y, w, h);
+    }
+
+    // Regions not inside the image are refused
+    queries++;
+    if (histogram_index_query(index, width - 1, 0, 2, 1, histogram) != -1 ||
+        histogram_index_query(index, 0, 0, 0, 1, histogram) != -1 ||
+        histogram_index_query(index, -1, 0, 1, 1, histogram) != -1) {
+        fprintf(stderr, "FAIL: %dx%d image accepted a region outside it\n", width, height);
+        failures++;
+    }
+
+    histogram_index_destroy(index);
+}
+
+int main(void)
+{
+    unsigned char *image;
+    size_t s, c, t, b, size, i;
+
+    srand(10);
+
+    for (s = 0; s < COUNT(sizes); s++) {
+        for (c = 0; c < COUNT(channel_counts); c++) {
+            size = (size_t)sizes[s][0] * sizes[s][1] * channel_counts[c];
+            image = malloc(size);
+            if (image == NULL) {
+                perror("Failed to allocate image");
+                return 1;
+            }
+            for (i = 0; i < size; i++)
+                image[i] = (unsigned char)rand();
+
+            for (t = 0; t < COUNT(tiles); t++) {
+                for (b = 0; b < COUNT(bin_counts); b++)
+                    test_index(image, sizes[s][0], sizes[s][1], channel_counts[c], tiles[t],
+                               bin_counts[b]);
+            }
+            free(image);
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d of %d queries failed\n", failures, queries);
+        return 1;
+    }
+    printf("All %d region queries match a direct rescan\n", queries);
+    return 0;
+}
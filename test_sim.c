@@ -0,0 +1,287 @@
+/*
+ * Userspace test of the display path against the in-process simulator:
+ * canvases and histograms drawn through histogram_lib must land in the
+ * simulated driver framebuffer in the driver's logical layout, and each
+ * commit must pick the blit (full frame, OP_UPDATE or OP_UPDATE_WIDE)
+ * and clock out only the digit rows that changed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "histogram_lib.h"
+#include "histogram_sim.h"
+#include "max7219_proto.h"
+
+#define HEADER_BYTES sizeof(struct max7219_blit_header)
+#define ROUNDS 50
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do {                               \
+        if (!(cond)) {                                      \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                   \
+            fputc('\n', stderr);                            \
+            failures++;                                     \
+        }                                                   \
+    } while (0)
+
+// Expected framebuffer, in the layout of the driver's display_byte():
+// pixel (x, y) is bit 7 - y % 8 of row 7 - x % 8 of matrix
+// (y / 8) * modules per row + x / 8
+static struct {
+    histogram_hw_config_t config;
+    uint8_t framebuffer[HISTOGRAM_SIM_MAX_MATRICES * HISTOGRAM_SIM_ROWS];
+    size_t bytes;
+} model;
+
+static void model_pixel(int x, int y, bool on)
+{
+    int matrix = (y / 8) * (model.config.width / 8) + x / 8;
+    uint8_t *byte = &model.framebuffer[matrix * HISTOGRAM_SIM_ROWS + 7 - x % 8];
+
+    if (x < 0 || x >= model.config.width || y < 0 || y >= model.config.height)
+        return;
+    if (on)
+        *byte |= (uint8_t)(0x80 >> (y % 8));
+    else
+        *byte &= (uint8_t)~(0x80 >> (y % 8));
+}
+
+static void model_rect(int x, int y, int w, int h, bool on)
+{
+    int i, j;
+
+    for (j = y; j < y + h; j++) {
+        for (i = x; i < x + w; i++)
+            model_pixel(i, j, on);
+    }
+}
+
+// Driver bytes and SPI transactions a call costs
+typedef struct {
+    uint64_t bytes;
+    uint64_t transactions;
+} cost_t;
+
+static cost_t cost_now(histogram_sim_t *sim)
+{
+    histogram_stats_t stats;
+    histogram_sim_stats_t sim_stats;
+    cost_t cost;
+
+    histogram_get_stats(&stats);
+    histogram_sim_get_stats(sim, &sim_stats);
+    cost.bytes = stats.ops[HISTOGRAM_OP_DISPLAY].bytes;
+    cost.transactions = sim_stats.transactions;
+    return cost;
+}
+
+// Commit and check the driver bytes, the SPI transactions and the frame
+static void commit(histogram_canvas_t *canvas, histogram_sim_t *sim, const char *what,
+                   uint64_t bytes, uint64_t transactions)
+{
+    cost_t before = cost_now(sim), after;
+
+    CHECK(canvas_commit(canvas) == 0, "%s: commit failed", what);
+    after = cost_now(sim);
+    CHECK(after.bytes - before.bytes == bytes, "%s: %llu bytes written, want %llu", what,
+          (unsigned long long)(after.bytes - before.bytes), (unsigned long long)bytes);
+    CHECK(after.transactions - before.transactions == transactions,
+          "%s: %llu SPI transactions, want %llu", what,
+          (unsigned long long)(after.transactions - before.transactions),
+          (unsigned long long)transactions);
+    CHECK(memcmp(histogram_sim_framebuffer(sim), model.framebuffer, model.bytes) == 0,
+          "%s: framebuffer differs from the model", what);
+}
+
+// Digit rows (registers) the model differs from the last frame in
+static uint64_t changed_rows(const uint8_t *previous)
+{
+    uint64_t rows = 0;
+    size_t row, matrix;
+
+    for (row = 0; row < HISTOGRAM_SIM_ROWS; row++) {
+        for (matrix = 0; matrix < model.bytes / HISTOGRAM_SIM_ROWS; matrix++) {
+            if (previous[matrix * HISTOGRAM_SIM_ROWS + row] !=
+                model.framebuffer[matrix * HISTOGRAM_SIM_ROWS + row]) {
+                rows++;
+                break;
+            }
+        }
+    }
+    return rows;
+}
+
+static size_t changed_bytes(const uint8_t *previous)
+{
+    size_t i, count = 0;
+
+    for (i = 0; i < model.bytes; i++)
+        count += previous[i] != model.framebuffer[i];
+    return count;
+}
+
+static void test_canvas(const char *device)
+{
+    static const uint8_t sprite[8] = { 0x3C, 0x42, 0xA5, 0x81, 0xA5, 0x99, 0x42, 0x3C };
+    uint8_t previous[sizeof(model.framebuffer)];
+    histogram_ctx_t *ctx;
+    histogram_canvas_t *canvas;
+    histogram_sim_t *sim;
+    size_t entry, changes;
+    int round, i, x, y;
+    bool on;
+
+    ctx = histogram_ctx_open(device);
+    CHECK(ctx != NULL, "%s: open failed", device);
+    if (ctx == NULL)
+        return;
+    sim = histogram_ctx_sim(ctx);
+    canvas = canvas_create(ctx);
+    CHECK(sim != NULL && canvas != NULL, "%s: no simulator or canvas", device);
+    if (sim == NULL || canvas == NULL) {
+        histogram_ctx_close(ctx);
+        return;
+    }
+
+    memset(&model, 0, sizeof(model));
+    histogram_ctx_get_hw_config(ctx, &model.config);
+    model.bytes = (size_t)model.config.matrices * HISTOGRAM_SIM_ROWS;
+    entry = model.bytes > 256 ? 3 : 2;
+
+    // Nothing drawn: the display already shows a blank frame
+    commit(canvas, sim, "blank", 0, 0);
+
+    // One pixel in the last module: one update entry, one digit row
+    canvas_pixel(canvas, model.config.width - 1, model.config.height - 1, true);
+    model_pixel(model.config.width - 1, model.config.height - 1, true);
+    commit(canvas, sim, entry == 3 ? "wide update" : "update", HEADER_BYTES + entry, 1);
+
+    // Everything on: a full frame is shorter than the update
+    memcpy(previous, model.framebuffer, model.bytes);
+    canvas_rect(canvas, 0, 0, model.config.width, model.config.height, true);
+    model_rect(0, 0, model.config.width, model.config.height, true);
+    commit(canvas, sim, "full frame", HEADER_BYTES + model.bytes, changed_rows(previous));
+
+    // Lines, sprites and stray pixels, small and large changes
+    for (round = 0; round < ROUNDS; round++) {
+        memcpy(previous, model.framebuffer, model.bytes);
+        if (round % 10 == 0) {
+            canvas_clear(canvas);
+            memset(model.framebuffer, 0, model.bytes);
+        }
+        x = rand() % model.config.width;
+        y = rand() % model.config.height;
+        on = rand() & 1;
+        switch (round % 4) {
+        case 0:
+            canvas_hline(canvas, x - 3, y, 11, on);
+            model_rect(x - 3, y, 11, 1, on);
+            break;
+        case 1:
+            canvas_vline(canvas, x, y - 5, 13, on);
+            model_rect(x, y - 5, 1, 13, on);
+            break;
+        case 2:
+            canvas_sprite(canvas, x - 4, y - 4, sprite);
+            for (i = 0; i < 64; i++)
+                model_pixel(x - 4 + i % 8, y - 4 + i / 8, (sprite[i / 8] & (0x80 >> (i % 8))) != 0);
+            break;
+        default:
+            for (i = 0; i < 1 + round; i++) {
+                x = rand() % model.config.width;
+                y = rand() % model.config.height;
+                canvas_pixel(canvas, x, y, on);
+                model_pixel(x, y, on);
+            }
+            break;
+        }
+
+        changes = changed_bytes(previous);
+        if (changes == 0)
+            commit(canvas, sim, "unchanged", 0, 0);
+        else if (entry * changes < model.bytes)
+            commit(canvas, sim, "update", HEADER_BYTES + entry * changes,
+                   changed_rows(previous));
+        else
+            commit(canvas, sim, "frame", HEADER_BYTES + model.bytes, changed_rows(previous));
+    }
+
+    canvas_destroy(canvas);
+    histogram_ctx_close(ctx);
+}
+
+// Bars through histogram_ctx_display(), which draws on the context's own canvas
+static void test_bars(const char *device)
+{
+    uint8_t heights[256], previous[sizeof(model.framebuffer)];
+    histogram_ctx_t *ctx;
+    histogram_sim_t *sim;
+    cost_t before, after;
+    int round, x;
+
+    ctx = histogram_ctx_open(device);
+    CHECK(ctx != NULL, "%s: open failed", device);
+    if (ctx == NULL)
+        return;
+    sim = histogram_ctx_sim(ctx);
+    memset(&model, 0, sizeof(model));
+    histogram_ctx_get_hw_config(ctx, &model.config);
+    model.bytes = (size_t)model.config.matrices * HISTOGRAM_SIM_ROWS;
+
+    for (round = 0; round < ROUNDS; round++) {
+        memcpy(previous, model.framebuffer, model.bytes);
+        // Every other round repeats the last histogram
+        if (round % 2 == 0) {
+            for (x = 0; x < model.config.width; x++)
+                heights[x] = (uint8_t)(rand() % (model.config.height + 4));
+        }
+        memset(model.framebuffer, 0, model.bytes);
+        for (x = 0; x < model.config.width; x++) {
+            int h = heights[x] < model.config.height ? heights[x] : model.config.height;
+            model_rect(x, model.config.height - h, 1, h, true);
+        }
+
+        before = cost_now(sim);
+        CHECK(histogram_ctx_display(ctx, heights, model.config.width) == 0,
+              "%s: display failed", device);
+        after = cost_now(sim);
+        CHECK(memcmp(histogram_sim_framebuffer(sim), model.framebuffer, model.bytes) == 0,
+              "%s round %d: bars differ from the model", device, round);
+        CHECK(after.transactions - before.transactions == changed_rows(previous),
+              "%s round %d: %llu SPI transactions, want %llu", device, round,
+              (unsigned long long)(after.transactions - before.transactions),
+              (unsigned long long)changed_rows(previous));
+        if (round % 2 == 1)
+            CHECK(after.bytes == before.bytes, "%s: unchanged histogram was resent", device);
+    }
+
+    histogram_ctx_close(ctx);
+}
+
+int main(void)
+{
+    static const char *const devices[] = {
+        "sim:matrices=8,cols=4",        // 32x16 wall, byte indexes
+        "sim:matrices=4",               // the default single row
+        "sim:matrices=64,lanes=4",      // 256x16, two-byte indexes
+    };
+    size_t d;
+
+    srand(7219);
+
+    for (d = 0; d < sizeof(devices) / sizeof(devices[0]); d++) {
+        test_canvas(devices[d]);
+        test_bars(devices[d]);
+        printf("%s: %dx%d checked\n", devices[d], model.config.width, model.config.height);
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All simulator display tests passed\n");
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Userspace test of the lane shifter in max7219_spi.h against a mocked
+ * GPIO block. Every GPSET0/GPCLR0 store is recorded and replayed
+ * through a model of the pins: MOSI of each lane is sampled on every
+ * rising CLK edge while CS is low, and the decoded bits must be the
+ * bytes that were shifted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static void mock_write(volatile uint32_t *regs, unsigned int index, uint32_t value);
+
+#define MAX7219_GPIO_WRITE(regs, index, value) mock_write(regs, index, value)
+#include "max7219_spi.h"
+
+#define TEST_CLK  11
+#define TEST_CS   8
+#define TEST_BYTES 16       // bytes shifted into each lane
+#define FSEL_ALT0 0x4       // field value the mock block starts with
+
+static const unsigned int test_pins[MAX7219_SPI_MAX_LANES] = { 10, 9, 22, 23, 24, 25, 26, 27 };
+
+// Pin model fed by the recorded stores
+static struct {
+    uint32_t level;                     // current pin levels
+    unsigned int lanes;
+    unsigned int stores;
+    unsigned int edges;                 // rising CLK edges with CS low
+    unsigned int frames;                // CS rising edges
+    unsigned int bad_edges;             // CLK rising together with MOSI
+    uint8_t bits[MAX7219_SPI_MAX_LANES][TEST_BYTES];
+} mock;
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do {                               \
+        if (!(cond)) {                                      \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                   \
+            fputc('\n', stderr);                            \
+            failures++;                                     \
+        }                                                   \
+    } while (0)
+
+static void mock_write(volatile uint32_t *regs, unsigned int index, uint32_t value)
+{
+    uint32_t before = mock.level;
+    unsigned int lane, bit;
+
+    regs[index] = value;
+    mock.stores++;
+
+    if (index == MAX7219_GPSET0)
+        mock.level |= value;
+    else if (index == MAX7219_GPCLR0)
+        mock.level &= ~value;
+    else
+        CHECK(0, "store to register %u", index);
+
+    if (!(before & (1u << TEST_CLK)) && (mock.level & (1u << TEST_CLK)) &&
+        !(mock.level & (1u << TEST_CS))) {
+        // Data must already be stable: the rising edge is a CLK-only store
+        if (value != (1u << TEST_CLK))
+            mock.bad_edges++;
+        bit = mock.edges++;
+        for (lane = 0; lane < mock.lanes && bit < TEST_BYTES * 8; lane++) {
+            if (mock.level & (1u << test_pins[lane]))
+                mock.bits[lane][bit / 8] |= (uint8_t)(0x80 >> (bit % 8));
+        }
+    }
+    if (!(before & (1u << TEST_CS)) && (mock.level & (1u << TEST_CS)))
+        mock.frames++;
+}
+
+static unsigned int fsel_field(volatile const uint32_t *regs, unsigned int pin)
+{
+    return (regs[MAX7219_GPFSEL0 + pin / 10] >> ((pin % 10) * 3)) & 7;
+}
+
+static void test_init(volatile uint32_t *regs, unsigned int lanes)
+{
+    uint32_t used = (1u << TEST_CLK) | (1u << TEST_CS);
+    unsigned int lane, pin;
+
+    for (lane = 0; lane < lanes; lane++)
+        used |= 1u << test_pins[lane];
+
+    for (pin = 0; pin < 32; pin++) {
+        if (used & (1u << pin))
+            CHECK(fsel_field(regs, pin) == 1, "%u lanes: GPIO %u function %u, want output",
+                  lanes, pin, fsel_field(regs, pin));
+        else
+            CHECK(fsel_field(regs, pin) == FSEL_ALT0, "%u lanes: GPIO %u function changed to %u",
+                  lanes, pin, fsel_field(regs, pin));
+    }
+
+    CHECK(!(mock.level & (1u << TEST_CLK)), "%u lanes: CLK high after init", lanes);
+    CHECK(mock.level & (1u << TEST_CS), "%u lanes: CS low after init", lanes);
+    for (lane = 0; lane < lanes; lane++)
+        CHECK(!(mock.level & (1u << test_pins[lane])), "%u lanes: MOSI %u high after init",
+              lanes, lane);
+}
+
+static void test_lanes(unsigned int lanes)
+{
+    volatile uint32_t regs[64];
+    struct max7219_spi spi;
+    uint8_t data[MAX7219_SPI_MAX_LANES][TEST_BYTES];
+    uint8_t bytes[MAX7219_SPI_MAX_LANES];
+    unsigned int lane, i, fsel;
+
+    // Every function select field starts as ALT0, every pin high
+    for (i = 0; i < 64; i++)
+        regs[i] = 0;
+    for (fsel = 0; fsel < 6; fsel++) {
+        for (i = 0; i < 10; i++)
+            regs[MAX7219_GPFSEL0 + fsel] |= (uint32_t)FSEL_ALT0 << (i * 3);
+    }
+    memset(&mock, 0, sizeof(mock));
+    mock.level = ~0u;
+    mock.lanes = lanes;
+
+    max7219_spi_init(&spi, regs, TEST_CLK, TEST_CS, test_pins, lanes);
+    test_init(regs, lanes);
+
+    for (lane = 0; lane < lanes; lane++) {
+        for (i = 0; i < TEST_BYTES; i++)
+            data[lane][i] = (uint8_t)rand();
+    }
+    // Edge patterns: all ones then all zeros on lane 0
+    data[0][0] = 0xFF;
+    data[0][1] = 0x00;
+
+    mock.stores = 0;
+    max7219_spi_select(&spi);
+    for (i = 0; i < TEST_BYTES; i++) {
+        for (lane = 0; lane < lanes; lane++)
+            bytes[lane] = data[lane][i];
+        max7219_spi_shift(&spi, bytes);
+    }
+    max7219_spi_deselect(&spi);
+
+    CHECK(mock.edges == TEST_BYTES * 8, "%u lanes: %u clock edges, want %d",
+          lanes, mock.edges, TEST_BYTES * 8);
+    CHECK(mock.frames == 1, "%u lanes: %u CS frames, want 1", lanes, mock.frames);
+    CHECK(mock.bad_edges == 0, "%u lanes: %u rising clock edges changed MOSI too",
+          lanes, mock.bad_edges);
+    CHECK(!(mock.level & (1u << TEST_CLK)), "%u lanes: CLK left high", lanes);
+    // Per bit: CLK fall with the MOSI falls, the MOSI rises, CLK rise.
+    // Per byte: the final CLK fall. Per frame: CS fall and rise.
+    CHECK(mock.stores <= TEST_BYTES * (8 * 3 + 1) + 2, "%u lanes: %u stores for %d bits",
+          lanes, mock.stores, TEST_BYTES * 8);
+    for (lane = 0; lane < lanes; lane++)
+        CHECK(memcmp(mock.bits[lane], data[lane], TEST_BYTES) == 0,
+              "%u lanes: lane %u decoded the wrong bits", lanes, lane);
+
+    printf("%u lane%s: %u stores for %d bit times\n", lanes, lanes == 1 ? "" : "s",
+           mock.stores, TEST_BYTES * 8);
+}
+
+int main(void)
+{
+    srand(7219);
+
+    test_lanes(1);
+    test_lanes(2);
+    test_lanes(4);
+    test_lanes(MAX7219_SPI_MAX_LANES);
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All SPI lane tests passed\n");
+    return 0;
+}